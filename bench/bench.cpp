@@ -112,6 +112,177 @@ static void bench_parse_github_events() {
     print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
 }
 
+static void bench_parse_github_events_insitu() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        json::parse(file, fe::parse_flags::insitu);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_parse_github_events_exact_size() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        json::parse(file, fe::parse_flags::exact_size);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_parse_github_events_intern_keys() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        json::parse(file, fe::parse_flags::intern_keys);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_parser_github_events() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    fe::parser parser;
+    parser.parse(file);
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        parser.parse(file);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+// Counts values without building a document
+struct counting_handler : fe::sax_handler {
+    uint64_t values = 0;
+    bool on_null() { values++; return true; }
+    bool on_bool(bool) { values++; return true; }
+    bool on_int(int64_t) { values++; return true; }
+    bool on_uint(uint64_t) { values++; return true; }
+    bool on_double(double) { values++; return true; }
+    bool on_string(const fe::string_t&) { values++; return true; }
+};
+
+static void bench_parse_sax_github_events() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        counting_handler handler;
+        t.start();
+        json::parse_sax(file, handler);
+        t.stop();
+        do_not_optimize(handler.values);
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_parse_tape_github_events() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        fe::tape_document::parse(file);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_ondemand_github_events() {
+    std::string file = read_file("data/github_events.json");
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        fe::ondemand_document doc(file);
+        auto event = doc[10];
+        do_not_optimize(event["type"].get<fe::string_t>().value().data);
+        do_not_optimize(event["actor"]["login"].get<fe::string_t>().value().data);
+        do_not_optimize(event["created_at"].get<fe::string_t>().value().data);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_parse_paths_github_events() {
+    std::string file = read_file("data/github_events.json");
+    std::vector<std::string> paths = {"/10/type", "/10/actor/login", "/10/created_at"};
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        json::parse_paths(file, paths);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+static void bench_parse_until_github_events() {
+    std::string file = read_file("data/github_events.json");
+    std::vector<std::string> paths = {"/0/type", "/0/actor/login"};
+    constexpr int32_t iterations = 5000;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        json::parse_until(file, paths);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
+// Looks up every key of an object with a few hundred members
+static void bench_lookup_wide_object() {
+    std::string file = "{";
+    std::vector<std::string> keys;
+    for (int i = 0; i < 500; i++) {
+        keys.push_back("property_" + std::to_string(i * 7919));
+        file += (i ? ", \"" : "\"") + keys.back() + "\": " + std::to_string(i);
+    }
+    file += "}";
+    json doc = json::parse(file).value();
+    constexpr int32_t iterations = 200;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        for (const std::string& key : keys) {
+            do_not_optimize(doc[key]);
+        }
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
+}
+
 static void bench_parse_san_fran() {
     std::string file = read_file("large_data/san_fran_parcels.json");
     constexpr int32_t iterations = 5;
@@ -126,6 +297,21 @@ static void bench_parse_san_fran() {
     print_stats(__FUNCTION__, avg, (file.size() / avg) / (1024*1024), iterations);
 }
 
+static void bench_parse_file_san_fran() {
+    const char* path = "large_data/san_fran_parcels.json";
+    size_t size = read_file(path).size();
+    constexpr int32_t iterations = 5;
+    timer t;
+    reset_mem_stats_for_bench();
+    for (int32_t i = 0; i < iterations; i++) {
+        t.start();
+        json::parse_file(path, fe::parse_flags::insitu);
+        t.stop();
+    }
+    double avg = t.accumulated_seconds / iterations;
+    print_stats(__FUNCTION__, avg, (size / avg) / (1024*1024), iterations);
+}
+
 static void bench_parse_canada() {
     std::string file = read_file("large_data/canada.json");
     constexpr int32_t iterations = 200;
@@ -165,7 +351,18 @@ int main() {
               << std::setw(20) << "iterations";
     std::cout << "\n" << std::string(140, '_') << "\n";
     bench::bench_parse_github_events();
+    bench::bench_parse_github_events_insitu();
+    bench::bench_parse_github_events_exact_size();
+    bench::bench_parse_github_events_intern_keys();
+    bench::bench_parser_github_events();
+    bench::bench_parse_sax_github_events();
+    bench::bench_parse_tape_github_events();
+    bench::bench_ondemand_github_events();
+    bench::bench_parse_paths_github_events();
+    bench::bench_parse_until_github_events();
+    bench::bench_lookup_wide_object();
     bench::bench_parse_san_fran();
+    bench::bench_parse_file_san_fran();
     bench::bench_parse_canada();
     bench::bench_parse_twitter();
 }
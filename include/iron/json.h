@@ -1,20 +1,29 @@
 
 #pragma once
 
+#include <algorithm>
 #include <deque>
 #include <initializer_list>
 #include <iosfwd>
 #include <limits>
-#include <stack>
 #include <string>
 #include <vector>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 #include <cassert>
+#include <clocale>
 #include <cfloat>
 #include <cmath> // std::pow
+#include <cstddef>
 #include <cstring>
 #include <stdint.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace fe {
 namespace {
 template <typename T, typename U>
@@ -171,7 +180,15 @@ struct arena_allocator {
         head_ = alloc_block(4096, nullptr);
     }
 
+    // Starts with room for capacity bytes in one block
+    explicit arena_allocator(size_t capacity) {
+        head_ = alloc_block(capacity + sizeof(block), nullptr);
+    }
+
     ~arena_allocator() {
+        for (cleanup* c = cleanups_; c; c = c->next) {
+            c->fn(c->data, c->size);
+        }
         while (head_) {
             void* to_free = head_;
             head_ = head_->prev;
@@ -204,7 +221,48 @@ struct arena_allocator {
         return reinterpret_cast<void*>(pointer_loc);
     }
 
+    // Frees everything allocated so far but keeps the largest block for reuse
+    void reset() {
+        for (cleanup* c = cleanups_; c; c = c->next) {
+            c->fn(c->data, c->size);
+        }
+        cleanups_ = nullptr;
+        while (head_->prev) {
+            block* prev = head_->prev;
+            head_->prev = prev->prev;
+            ::free(prev);
+        }
+        head_->used = sizeof(block);
+    }
+
+    // Number of blocks allocated so far, 1 until the first one fills up
+    size_t blocks() const {
+        size_t n = 0;
+        for (const block* b = head_; b; b = b->prev) {
+            n++;
+        }
+        return n;
+    }
+
+    // Calls fn(data, size) when the arena is destroyed. For buffers that memory in the arena points into
+    void on_destroy(void (*fn)(void*, size_t), void* data, size_t size) {
+        cleanup* c = static_cast<cleanup*>(alloc(sizeof(cleanup), alignof(cleanup)));
+        c->fn = fn;
+        c->data = data;
+        c->size = size;
+        c->next = cleanups_;
+        cleanups_ = c;
+    }
+
 private:
+    struct cleanup {
+        void (*fn)(void*, size_t);
+        void* data;
+        size_t size;
+        cleanup* next;
+    };
+    cleanup* cleanups_ = nullptr;
+
     struct block {
         void* data;
         size_t size;
@@ -271,10 +329,516 @@ struct string {
     friend std::ostream& operator<<(std::ostream& os, const string& rhs);
 };
 
+namespace simd {
+
+// Bitmasks describing one 64 byte block of input. Bit i describes byte i.
+struct block_masks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t whitespace;
+    uint64_t op; // Structural characters: { } [ ] : ,
+};
+
+// Bitmasks describing 64 bytes of the inside of a string
+struct string_masks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t control; // Bytes below 0x20, which must be escaped
+    uint64_t non_ascii;
+};
+
+#if defined(__AVX2__)
+using vec_t = __m256i;
+constexpr size_t vec_width = 32;
+inline vec_t load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline vec_t splat(char c) { return _mm256_set1_epi8(c); }
+inline vec_t eq(vec_t v, char c) { return _mm256_cmpeq_epi8(v, splat(c)); }
+inline vec_t bit_or(vec_t a, vec_t b) { return _mm256_or_si256(a, b); }
+inline vec_t max_u8(vec_t a, vec_t b) { return _mm256_max_epu8(a, b); }
+inline uint64_t to_bits(vec_t v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+#elif defined(__SSE2__)
+using vec_t = __m128i;
+constexpr size_t vec_width = 16;
+inline vec_t load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline vec_t splat(char c) { return _mm_set1_epi8(c); }
+inline vec_t eq(vec_t v, char c) { return _mm_cmpeq_epi8(v, splat(c)); }
+inline vec_t bit_or(vec_t a, vec_t b) { return _mm_or_si128(a, b); }
+inline vec_t max_u8(vec_t a, vec_t b) { return _mm_max_epu8(a, b); }
+inline uint64_t to_bits(vec_t v) { return static_cast<uint16_t>(_mm_movemask_epi8(v)); }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+inline block_masks classify(const char* block) {
+    block_masks m = {0, 0, 0, 0};
+    for (size_t i = 0; i < 64; i += vec_width) {
+        vec_t v = load(block + i);
+        // '[' and ']' differ from '{' and '}' only by 0x20
+        vec_t folded = bit_or(v, splat(0x20));
+        m.quote |= to_bits(eq(v, '"')) << i;
+        m.backslash |= to_bits(eq(v, '\\')) << i;
+        m.whitespace |= to_bits(bit_or(bit_or(eq(v, ' '), eq(v, '\t')), bit_or(eq(v, '\n'), eq(v, '\r')))) << i;
+        m.op |= to_bits(bit_or(bit_or(eq(folded, '{'), eq(folded, '}')), bit_or(eq(v, ':'), eq(v, ',')))) << i;
+    }
+    return m;
+}
+
+inline string_masks classify_string(const char* block) {
+    string_masks m = {0, 0, 0, 0};
+    for (size_t i = 0; i < 64; i += vec_width) {
+        vec_t v = load(block + i);
+        m.quote |= to_bits(eq(v, '"')) << i;
+        m.backslash |= to_bits(eq(v, '\\')) << i;
+        // Unsigned v <= 0x1F
+        m.control |= to_bits(eq(max_u8(v, splat(0x1F)), 0x1F)) << i;
+        m.non_ascii |= to_bits(v) << i;
+    }
+    return m;
+}
+#else
+inline block_masks classify(const char* block) {
+    block_masks m = {0, 0, 0, 0};
+    for (size_t i = 0; i < 64; i++) {
+        uint64_t bit = uint64_t(1) << i;
+        switch (block[i]) {
+            case '"': m.quote |= bit; break;
+            case '\\': m.backslash |= bit; break;
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r': m.whitespace |= bit; break;
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ':':
+            case ',': m.op |= bit; break;
+            default: break;
+        }
+    }
+    return m;
+}
+
+inline string_masks classify_string(const char* block) {
+    string_masks m = {0, 0, 0, 0};
+    for (size_t i = 0; i < 64; i++) {
+        uint64_t bit = uint64_t(1) << i;
+        unsigned char c = static_cast<unsigned char>(block[i]);
+        if (c == '"') m.quote |= bit;
+        else if (c == '\\') m.backslash |= bit;
+        else if (c < 0x20) m.control |= bit;
+        else if (c > 0x7F) m.non_ascii |= bit;
+    }
+    return m;
+}
+#endif
+
+// Bit i of the result is the xor of bits [0, i] of the input
+inline uint64_t prefix_xor(uint64_t bits) {
+#if defined(__PCLMUL__)
+    __m128i all_ones = _mm_set1_epi8('\xFF');
+    __m128i result = _mm_clmulepi64_si128(_mm_set_epi64x(0ULL, static_cast<long long>(bits)), all_ones, 0);
+    return static_cast<uint64_t>(_mm_cvtsi128_si64(result));
+#else
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+#endif
+}
+
+// Returns the characters escaped by a preceeding odd-length run of backslashes.
+// prev_escaped carries whether the first character of the next block is escaped.
+inline uint64_t find_escaped(uint64_t backslash, uint64_t& prev_escaped) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+    // A backslash escaped by the previous block is not the start of an escape
+    backslash &= ~prev_escaped;
+    uint64_t follows_escape = (backslash << 1) | prev_escaped;
+    // Adding the start of each run that begins on an odd bit carries through the run
+    uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+    prev_escaped = sequences_starting_on_even_bits < backslash ? 1 : 0;
+    uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+
+inline int trailing_zeroes(uint64_t bits) {
+    return __builtin_ctzll(bits);
+}
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#if defined(__AVX2__)
+inline vec_t zero() { return _mm256_setzero_si256(); }
+inline vec_t table(const uint8_t* t) { return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t))); }
+inline vec_t lookup(vec_t t, vec_t index) { return _mm256_shuffle_epi8(t, index); }
+inline vec_t bit_and(vec_t a, vec_t b) { return _mm256_and_si256(a, b); }
+inline vec_t bit_xor(vec_t a, vec_t b) { return _mm256_xor_si256(a, b); }
+inline vec_t shr4(vec_t v) { return bit_and(_mm256_srli_epi16(v, 4), splat(0x0F)); }
+inline vec_t saturating_sub(vec_t a, vec_t b) { return _mm256_subs_epu8(a, b); }
+inline bool any(vec_t v) { return !_mm256_testz_si256(v, v); }
+// The last N bytes of prev_input followed by the first bytes of input
+template <int N>
+inline vec_t prev(vec_t input, vec_t prev_input) {
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - N);
+}
+#else
+inline vec_t zero() { return _mm_setzero_si128(); }
+inline vec_t table(const uint8_t* t) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(t)); }
+inline vec_t lookup(vec_t t, vec_t index) { return _mm_shuffle_epi8(t, index); }
+inline vec_t bit_and(vec_t a, vec_t b) { return _mm_and_si128(a, b); }
+inline vec_t bit_xor(vec_t a, vec_t b) { return _mm_xor_si128(a, b); }
+inline vec_t shr4(vec_t v) { return bit_and(_mm_srli_epi16(v, 4), splat(0x0F)); }
+inline vec_t saturating_sub(vec_t a, vec_t b) { return _mm_subs_epu8(a, b); }
+inline bool any(vec_t v) { return _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero())) != 0xFFFF; }
+template <int N>
+inline vec_t prev(vec_t input, vec_t prev_input) {
+    return _mm_alignr_epi8(input, prev_input, 16 - N);
+}
+#endif
+
+/*
+ * UTF-8 validation with lookup tables, after Keiser and Lemire,
+ * "Validating UTF-8 In Less Than One Instruction Per Byte".
+ * Each byte is checked against the high and low nibbles of the byte before it, which catches
+ * truncated and overlong sequences, surrogates, and code points above U+10FFFF.
+ * Sequences of 3 and 4 bytes are then checked to have the right number of continuations.
+ */
+struct utf8_checker {
+    vec_t error = zero();
+    vec_t prev_input = zero();
+    vec_t prev_incomplete = zero();
+
+    void check(vec_t input) {
+        if (to_bits(input) == 0) {
+            // ASCII is valid as long as the previous bytes did not need continuing
+            error = bit_or(error, prev_incomplete);
+            return;
+        }
+
+        const uint8_t too_short = 1 << 0; // 11______ 0_______ or 11______ 11______
+        const uint8_t too_long = 1 << 1; // 0_______ 10______
+        const uint8_t overlong_3 = 1 << 2; // 11100000 100_____
+        const uint8_t too_large = 1 << 3; // 11110100 1001____ and above
+        const uint8_t surrogate = 1 << 4; // 11101101 101_____
+        const uint8_t overlong_2 = 1 << 5; // 1100000_ 10______
+        const uint8_t too_large_1000 = 1 << 6; // 11110101 1000____ and above
+        const uint8_t overlong_4 = 1 << 6; // 11110000 1000____
+        const uint8_t two_conts = 1 << 7; // 10______ 10______
+        const uint8_t carry = too_short | too_long | two_conts;
+
+        static const uint8_t byte_1_high_table[16] = {
+            // 0_______ ________ <ASCII in byte 1>
+            too_long, too_long, too_long, too_long,
+            too_long, too_long, too_long, too_long,
+            // 10______ ________ <continuation in byte 1>
+            two_conts, two_conts, two_conts, two_conts,
+            // 1100____ ________ <two byte lead in byte 1>
+            too_short | overlong_2,
+            // 1101____ ________ <two byte lead in byte 1>
+            too_short,
+            // 1110____ ________ <three byte lead in byte 1>
+            too_short | overlong_3 | surrogate,
+            // 1111____ ________ <four+ byte lead in byte 1>
+            too_short | too_large | too_large_1000 | overlong_4,
+        };
+        static const uint8_t byte_1_low_table[16] = {
+            // ____0000 ________
+            carry | overlong_3 | overlong_2 | overlong_4,
+            // ____0001 ________
+            carry | overlong_2,
+            // ____001_ ________
+            carry,
+            carry,
+            // ____0100 ________
+            carry | too_large,
+            // ____0101 ________
+            carry | too_large | too_large_1000,
+            // ____011_ ________
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            // ____1___ ________
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            // ____1101 ________
+            carry | too_large | too_large_1000 | surrogate,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+        };
+        static const uint8_t byte_2_high_table[16] = {
+            // ________ 0_______ <ASCII in byte 2>
+            too_short, too_short, too_short, too_short,
+            too_short, too_short, too_short, too_short,
+            // ________ 1000____
+            too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+            // ________ 1001____
+            too_long | overlong_2 | two_conts | overlong_3 | too_large,
+            // ________ 101_____
+            too_long | overlong_2 | two_conts | surrogate | too_large,
+            too_long | overlong_2 | two_conts | surrogate | too_large,
+            // ________ 11______
+            too_short, too_short, too_short, too_short,
+        };
+        // Saturating subtraction leaves the high bit set only for bytes >= the limit
+        static const uint8_t incomplete_limits[32] = {
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+        };
+
+        vec_t prev1 = prev<1>(input, prev_input);
+        vec_t special_cases = bit_and(bit_and(
+            lookup(table(byte_1_high_table), shr4(prev1)),
+            lookup(table(byte_1_low_table), bit_and(prev1, splat(0x0F)))),
+            lookup(table(byte_2_high_table), shr4(input)));
+
+        // Only 111_____ two bytes back or 1111____ three bytes back require a continuation here
+        vec_t is_third_byte = saturating_sub(prev<2>(input, prev_input), splat(static_cast<char>(0xE0 - 0x80)));
+        vec_t is_fourth_byte = saturating_sub(prev<3>(input, prev_input), splat(static_cast<char>(0xF0 - 0x80)));
+        vec_t must_be_continuation = bit_and(bit_or(is_third_byte, is_fourth_byte), splat(static_cast<char>(0x80)));
+        error = bit_or(error, bit_xor(must_be_continuation, special_cases));
+
+        prev_incomplete = saturating_sub(input, load(reinterpret_cast<const char*>(incomplete_limits) + 32 - vec_width));
+        prev_input = input;
+    }
+
+    bool finish() {
+        return !any(bit_or(error, prev_incomplete));
+    }
+};
+
+inline bool validate_utf8(const char* str, size_t len) {
+    utf8_checker checker;
+    size_t i = 0;
+    for (; i + vec_width <= len; i += vec_width) {
+        checker.check(load(str + i));
+    }
+    if (i < len) {
+        char block[vec_width] = {};
+        memcpy(block, str + i, len - i);
+        checker.check(load(block));
+    }
+    return checker.finish();
+}
+#else
+inline bool validate_utf8(const char* str, size_t len) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(str);
+    size_t i = 0;
+    while (i < len) {
+        // Skip ASCII 8 bytes at a time
+        if (i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if ((word & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char byte_0 = s[i];
+        if (byte_0 <= 0x7F) {
+            i++;
+            continue;
+        }
+        size_t n = 0;
+        uint32_t codepoint = 0;
+        if ((byte_0 & 0xE0) == 0xC0) {
+            n = 2;
+            codepoint = byte_0 & 0x1F;
+        } else if ((byte_0 & 0xF0) == 0xE0) {
+            n = 3;
+            codepoint = byte_0 & 0x0F;
+        } else if ((byte_0 & 0xF8) == 0xF0) {
+            n = 4;
+            codepoint = byte_0 & 0x07;
+        } else {
+            return false;
+        }
+        if (len - i < n) return false;
+        for (size_t k = 1; k < n; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) return false;
+            codepoint = (codepoint << 6) | (s[i + k] & 0x3F);
+        }
+        // Overlong encodings, surrogates, and code points past U+10FFFF
+        if ((n == 2 && codepoint < 0x80) ||
+            (n == 3 && (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF))) ||
+            (n == 4 && (codepoint < 0x10000 || codepoint > 0x10FFFF))) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+#endif
+
+// SWAR (SIMD within a register) digit parsing. Loads 8 characters with the first one in the low byte
+inline uint64_t load_eight(const char* c) {
+    uint64_t word;
+    memcpy(&word, c, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// True if every byte is '0'-'9'. Adding 6 carries bytes above '9' into the high nibble
+inline bool is_eight_digits(uint64_t word) {
+    return ((word & 0xF0F0F0F0F0F0F0F0ULL) |
+        (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+// Converts 8 digits with 3 multiplications, combining pairs, then quads, then both halves
+inline uint32_t parse_eight_digits(uint64_t word) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ULL; // 1 + (10000 << 32)
+    word -= 0x3030303030303030ULL;
+    word = (word * 10) + (word >> 8);
+    word = (((word & mask) * mul1) + (((word >> 16) & mask) * mul2)) >> 32;
+    return static_cast<uint32_t>(word);
+}
+
+// Accumulates a run of digits into u, 8 at a time while they last. Returns the first non-digit
+inline const char* parse_digits(const char* c, const char* cend, uint64_t& u) {
+    uint64_t v = u;
+    while (cend - c >= 8) {
+        uint64_t word = load_eight(c);
+        if (!is_eight_digits(word)) {
+            break;
+        }
+        v = v * 100000000 + parse_eight_digits(word);
+        c += 8;
+    }
+    while (c != cend && *c >= '0' && *c <= '9') {
+        v = v * 10 + (*c - '0');
+        c++;
+    }
+    u = v;
+    return c;
+}
+
+} // namespace simd
+
+// Offsets of the structural characters and the first byte of every value in a document,
+// outside of strings. Produced by json::find_structurals.
+struct structural_index {
+    uint32_t* positions = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    structural_index() = default;
+    structural_index(const structural_index&) = delete;
+    structural_index& operator=(const structural_index&) = delete;
+    ~structural_index() {
+        free(positions);
+    }
+
+    void clear() {
+        size = 0;
+    }
+
+    void reserve(size_t n) {
+        if (n <= capacity) return;
+        size_t next_capacity = std::max(capacity * 2, n);
+        positions = static_cast<uint32_t*>(realloc(positions, next_capacity * sizeof(uint32_t)));
+        capacity = next_capacity;
+    }
+};
+
+// Growable stack in one contiguous block. Values are relocated with memcpy when it grows and when
+// they are moved out, so it only holds types that don't point into themselves, like json and
+// string_t. clear() keeps the capacity
+template <typename T>
+struct scratch_stack {
+    T* data = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    scratch_stack() = default;
+    scratch_stack(const scratch_stack&) = delete;
+    scratch_stack& operator=(const scratch_stack&) = delete;
+    scratch_stack(scratch_stack&& other) {
+        *this = std::move(other);
+    }
+    scratch_stack& operator=(scratch_stack&& other) {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        std::swap(capacity, other.capacity);
+        return *this;
+    }
+    ~scratch_stack() {
+        clear();
+        free(data);
+    }
+
+    bool empty() const {
+        return size == 0;
+    }
+
+    T& back() {
+        return data[size - 1];
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (size == capacity) {
+            size_t next_capacity = std::max(capacity * 2, size_t(64));
+            data = static_cast<T*>(realloc(static_cast<void*>(data), next_capacity * sizeof(T)));
+            capacity = next_capacity;
+        }
+        return *new (data + size++) T(std::forward<Args>(args)...);
+    }
+
+    void pop_back() {
+        data[--size].~T();
+    }
+
+    // Moves the last n values onto the end of v in one copy
+    template <typename Vector>
+    void move_back_to(Vector& v, size_t n) {
+        size_t at = v.size();
+        // Value initialized elements own nothing, so they can be written over
+        v.resize(at + n);
+        memcpy(static_cast<void*>(v.data() + at), static_cast<const void*>(data + size - n), n * sizeof(T));
+        size -= n;
+    }
+
+    void clear() {
+        while (size) {
+            pop_back();
+        }
+    }
+};
+
 enum class json_error: uint8_t {
     invalid_type,
 };
 
+enum class parse_flags: uint32_t {
+    none = 0,
+    // Strings without escapes reference the input instead of being copied into the document.
+    // The input must outlive the document.
+    insitu = 1 << 0,
+    // Measures the document from its structural index first and gives it an arena of one block
+    // that is big enough for all of it. Costs an extra pass over the index but the document then
+    // takes a single allocation and no more memory than it needs.
+    exact_size = 1 << 1,
+    // Gives every key with the same text in a document the same storage, through a key_table
+    intern_keys = 1 << 2,
+};
+
+inline parse_flags operator|(parse_flags lhs, parse_flags rhs) {
+    return static_cast<parse_flags>(static_cast<uint32_t>(lhs) | static_cast<uint32_t>(rhs));
+}
+
+inline bool operator&(parse_flags lhs, parse_flags rhs) {
+    return (static_cast<uint32_t>(lhs) & static_cast<uint32_t>(rhs)) != 0;
+}
+
 enum class value_t: uint8_t {
     object,
     owned_object,
@@ -289,10 +853,311 @@ enum class value_t: uint8_t {
     null,
 };
 
+/*
+ * Allocator for the element storage of arrays and objects.
+ * With an arena the elements live in it and are never freed on their own, which is what parsed
+ * documents use. Without one they are allocated on the heap like a std::allocator.
+ * Copies of a container always go on the heap, since the copy may outlive the arena.
+ */
+template <typename T>
+struct element_allocator {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    arena_allocator* arena = nullptr;
+
+    element_allocator() = default;
+    explicit element_allocator(arena_allocator* arena) : arena(arena) {}
+    template <typename U>
+    element_allocator(const element_allocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        if (arena) {
+            return static_cast<T*>(arena->alloc(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t) {
+        if (!arena) {
+            ::operator delete(p);
+        }
+    }
+
+    element_allocator select_on_container_copy_construction() const {
+        return element_allocator();
+    }
+
+    template <typename U>
+    friend bool operator==(const element_allocator& lhs, const element_allocator<U>& rhs) {
+        return lhs.arena == rhs.arena;
+    }
+
+    template <typename U>
+    friend bool operator!=(const element_allocator& lhs, const element_allocator<U>& rhs) {
+        return lhs.arena != rhs.arena;
+    }
+};
+
 class json;
+class ondemand_document;
 using string_t = string;
-using array_t = std::vector<json>;
-using object_t = std::vector<std::pair<string_t, json>>;
+using array_t = std::vector<json, element_allocator<json>>;
+
+// Positions of an object's members in a hash table of their keys, see object_t
+struct member_index {
+    // Members [0, size) of the object are in the table
+    size_t size;
+    // Always a power of 2
+    size_t capacity;
+    // Allocated with malloc because the object isn't in an arena
+    bool on_heap;
+
+    // The hash of a member's key is kept with its position so probes only read the members they match
+    struct slot {
+        // Position of the member + 1, or 0 while the slot is empty
+        uint32_t position;
+        uint32_t hash;
+    };
+
+    // Followed by capacity slots
+    slot* slots() {
+        return reinterpret_cast<slot*>(this + 1);
+    }
+};
+
+/*
+ * Members of an object in order, a std::vector of key/value pairs.
+ * Once an object has index_threshold members json::member() looks keys up through a hash index,
+ * built on the first lookup and kept in the arena with the members. Members appended since are
+ * added to it on the next lookup and it is rebuilt if the object shrinks. Copies start without one
+ * and json::items() drops it, since members can be reordered, renamed or erased through it. Members
+ * mustn't be changed that way through iterators taken before the last lookup.
+ */
+class object_t : public std::vector<std::pair<string_t, json>, element_allocator<std::pair<string_t, json>>> {
+public:
+    using base = std::vector<std::pair<string_t, json>, element_allocator<std::pair<string_t, json>>>;
+
+    // Smaller objects are scanned, which is faster than hashing while they fit in a few cache lines
+    static constexpr size_t index_threshold = 32;
+
+    using base::base;
+    object_t() = default;
+    object_t(const object_t& other);
+    object_t(object_t&& other);
+    object_t& operator=(const object_t& other);
+    object_t& operator=(object_t&& other);
+    ~object_t();
+
+    // Each index goes with the members it points at
+    void swap(object_t& other) {
+        base::swap(other);
+        std::swap(index_, other.index_);
+    }
+
+    friend void swap(object_t& lhs, object_t& rhs) {
+        lhs.swap(rhs);
+    }
+
+private:
+    friend class json;
+
+    member_index* index_ = nullptr;
+
+    void drop_index() {
+        if (index_ && index_->on_heap) {
+            free(index_);
+        }
+        index_ = nullptr;
+    }
+};
+
+// Hash of the bytes of a key. Reads 8 bytes at a time since keys are mostly short
+inline uint64_t hash_key(const char* data, size_t size) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 31;
+    }
+    if (i < size) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, size - i);
+        h = (h ^ w) * 0x94d049bb133111ebull;
+        h ^= h >> 29;
+    }
+    return h ^ (h >> 32);
+}
+
+/*
+ * Set of distinct keys, an open addressing hash table.
+ * With parse_flags::intern_keys each document is parsed with a table of its own so every key
+ * with the same text shares one copy in the arena, and comparing the pointers of two keys is
+ * enough to tell if they are equal. A table filled up front with add() can also be given to
+ * json::parse to be shared, read only, by any number of documents. Their keys then point at the
+ * table's copies, so it has to outlive them.
+ */
+class key_table {
+public:
+    key_table() = default;
+    key_table(std::initializer_list<const char*> keys) {
+        for (const char* key : keys) {
+            add(key);
+        }
+    }
+
+    key_table(const key_table&) = delete;
+    key_table& operator=(const key_table&) = delete;
+    key_table(key_table&& other) {
+        *this = std::move(other);
+    }
+    key_table& operator=(key_table&& other) {
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(arena_, other.arena_);
+        return *this;
+    }
+    ~key_table() {
+        free(slots_);
+        delete arena_;
+    }
+
+    // Adds a copy of key if it isn't in the table yet and returns the table's copy
+    string_t add(const char* key, size_t size) {
+        if (!arena_) {
+            arena_ = new arena_allocator();
+        }
+        return intern(key, size, hash_key(key, size), arena_);
+    }
+
+    string_t add(const char* key) {
+        return add(key, std::strlen(key));
+    }
+
+    string_t add(const std::string& key) {
+        return add(key.data(), key.size());
+    }
+
+    // The table's copy of key, or a string_t with null data if it isn't in the table
+    string_t find(const char* key, size_t size) const {
+        return find(key, size, hash_key(key, size));
+    }
+
+    string_t find(const char* key) const {
+        return find(key, std::strlen(key));
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Empties the table. Capacity is kept
+    void clear() {
+        if (size_) {
+            memset(static_cast<void*>(slots_), 0, capacity_ * sizeof(slot));
+            size_ = 0;
+        }
+        if (arena_) {
+            arena_->reset();
+        }
+    }
+
+private:
+    friend class json;
+
+    // Empty while key.data is null
+    struct slot {
+        string_t key;
+        uint64_t hash;
+    };
+    slot* slots_ = nullptr;
+    // Always a power of 2
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    // Holds the keys given to add()
+    arena_allocator* arena_ = nullptr;
+
+    string_t find(const char* key, size_t size, uint64_t hash) const {
+        if (!capacity_) {
+            return string_t{nullptr, 0};
+        }
+        for (size_t i = hash & (capacity_ - 1);; i = (i + 1) & (capacity_ - 1)) {
+            const slot& s = slots_[i];
+            if (!s.key.data) {
+                return string_t{nullptr, 0};
+            }
+            if (s.hash == hash && s.key.size == size && memcmp(s.key.data, key, size) == 0) {
+                return s.key;
+            }
+        }
+    }
+
+    // Finds key or adds it. New keys are copied into arena, or kept where they are if it is null
+    string_t intern(const char* key, size_t size, uint64_t hash, arena_allocator* arena) {
+        // Stay under 3/4 full so probe sequences stay short
+        if ((size_ + 1) * 4 > capacity_ * 3) {
+            grow();
+        }
+        size_t i = hash & (capacity_ - 1);
+        for (;; i = (i + 1) & (capacity_ - 1)) {
+            const slot& s = slots_[i];
+            if (!s.key.data) {
+                break;
+            }
+            if (s.hash == hash && s.key.size == size && memcmp(s.key.data, key, size) == 0) {
+                return s.key;
+            }
+        }
+        string_t copy{const_cast<char*>(key), size};
+        if (arena) {
+            copy.data = static_cast<char*>(arena->alloc(size, 1));
+            memcpy(copy.data, key, size);
+        }
+        slots_[i] = slot{copy, hash};
+        size_++;
+        return copy;
+    }
+
+    void grow() {
+        size_t old_capacity = capacity_;
+        slot* old_slots = slots_;
+        capacity_ = std::max(capacity_ * 2, size_t(16));
+        slots_ = static_cast<slot*>(calloc(capacity_, sizeof(slot)));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (!old_slots[i].key.data) {
+                continue;
+            }
+            size_t j = old_slots[i].hash & (capacity_ - 1);
+            while (slots_[j].key.data) {
+                j = (j + 1) & (capacity_ - 1);
+            }
+            slots_[j] = old_slots[i];
+        }
+        free(old_slots);
+    }
+};
+
+/*
+ * Events for json::parse_sax. Handlers can derive from this and only define the members they need.
+ * Returning false from any of them stops the parse.
+ */
+struct sax_handler {
+    bool on_null() { return true; }
+    bool on_bool(bool) { return true; }
+    bool on_int(int64_t) { return true; }
+    bool on_uint(uint64_t) { return true; }
+    bool on_double(double) { return true; }
+    bool on_string(const string_t&) { return true; }
+    bool on_key(const string_t&) { return true; }
+    bool on_start_object() { return true; }
+    bool on_end_object() { return true; }
+    bool on_start_array() { return true; }
+    bool on_end_array() { return true; }
+};
 
 class json {
     value_t type;
@@ -308,6 +1173,12 @@ class json {
     } value;
     arena_allocator* arena_ = nullptr;
 
+    friend class push_parser;
+    friend class tape_value;
+
+    // Set by parse_inplace, never by callers of parse. Escaped strings are decoded over the input
+    static constexpr parse_flags parse_flags_inplace = static_cast<parse_flags>(1u << 31);
+
     inline void destroy() {
         switch (type) {
             case value_t::object:
@@ -401,15 +1272,19 @@ class json {
     }
     
     static object_t* alloc_object(arena_allocator* arena) {
-        return new(arena->alloc(sizeof(object_t))) object_t();
+        return new(arena->alloc(sizeof(object_t))) object_t(object_t::allocator_type(arena));
     }
 
     static object_t* alloc_object(const object_t& o, arena_allocator* arena) {
-        return new(arena->alloc(sizeof(object_t))) object_t(o);
+        return new(arena->alloc(sizeof(object_t))) object_t(o, object_t::allocator_type(arena));
     }
 
     static object_t* alloc_object(object_t&& o, arena_allocator* arena) {
-        return new(arena->alloc(sizeof(object_t))) object_t(std::move(o));
+        return new(arena->alloc(sizeof(object_t))) object_t(std::move(o), object_t::allocator_type(arena));
+    }
+
+    static array_t* alloc_array(arena_allocator* arena) {
+        return new(arena->alloc(sizeof(array_t))) array_t(array_t::allocator_type(arena));
     }
 
 public:
@@ -511,6 +1386,14 @@ public:
         return json(array_t{});
     }
 
+    // An empty array whose elements will be allocated in arena
+    static json array(arena_allocator* arena) {
+        json j(arena);
+        j.type = value_t::array;
+        j.value.array = alloc_array(arena);
+        return j;
+    }
+
     static json array(const array_t& a) {
         return json(a);
     }
@@ -531,6 +1414,14 @@ public:
         return j;
     }
 
+    // A document whose arena starts with room for capacity bytes
+    static json doc(size_t capacity) {
+        json j;
+        j.arena_ = new arena_allocator(capacity);
+        j.owns_arena_ = true;
+        return j;
+    }
+
     json(const json& other) : type(other.type) {
         switch (type) {
             case value_t::object:
@@ -639,7 +1530,14 @@ public:
 
     json& operator=(json&& other) {
         if (this != &other) {
-            if (arena_ != other.arena_ || owns_arena_) {
+            if (other.owns_arena_) {
+                // Take over the whole document, arena included
+                swap(*this, other);
+            } else if (arena_ != other.arena_ || owns_arena_) {
+                // Released after the copy in case other is part of it
+                json previous;
+                previous.type = type;
+                previous.value = value;
                 if (!arena_) {
                     arena_ = other.arena_;
                 }
@@ -802,63 +1700,127 @@ public:
 
     // Object Operations
     
-    void become_object() {
-        assert(is_null());
-        if (arena_) {
-            type = value_t::object;
-            value.object = alloc_object(arena_);
-        } else {
-            type = value_t::owned_object;
-            value.object = new object_t();
-        }
+    // Hash of a key as kept in an object's index
+    static uint32_t member_hash(const char* key, size_t size) {
+        return static_cast<uint32_t>(hash_key(key, size) >> 32);
     }
-    
-    json& operator[](const char* k) {
+
+    // The value of the member named key, added as null if there isn't one.
+    // Large objects are searched through their index, smaller ones compare sizes before bytes
+    json& member(const char* key, size_t size) {
         if (is_null()) {
             become_object();
         }
 
-        for (auto& it : *value.object) {
-            if (it.first == k) {
-                return it.second;
+        if (value.object->size() >= object_t::index_threshold) {
+            if (json* found = find_indexed(*value.object, key, size, member_hash(key, size))) {
+                return *found;
+            }
+        } else {
+            for (auto& it : *value.object) {
+                if (same_key(it, key, size)) {
+                    return it.second;
+                }
             }
         }
 
         // owned_objects own the names in the object array
         if (type == value_t::object) {
             assert(arena_);
-            string_t name = alloc_string(k, arena_);
-            value.object->emplace_back(std::move(name), json(arena_));
+            value.object->emplace_back(alloc_string(key, size, arena_), json(arena_));
         } else {
             assert(type == value_t::owned_object);
-            string_t name = alloc_string(k);
-            value.object->emplace_back(std::move(name), json(arena_));
+            value.object->emplace_back(alloc_string(key, size), json(arena_));
         }
         return value.object->back().second;
     }
 
-    json& operator[](const std::string& k) {
-        if (is_null()) {
-            become_object();
+    // Keys with the same pointer, like interned ones, match without looking at their bytes
+    static bool same_key(const object_t::value_type& entry, const char* key, size_t size) {
+        return entry.first.size == size && (entry.first.data == key || memcmp(entry.first.data, key, size) == 0);
+    }
+
+    // Finds key through the object's index, bringing the index up to date first
+    static json* find_indexed(object_t& o, const char* key, size_t size, uint32_t hash) {
+        member_index* index = o.index_;
+        // Rebuilt at over half full so probe sequences stay short
+        if (!index || index->size > o.size() || o.size() * 2 > index->capacity) {
+            index = build_index(o);
+        } else {
+            for (size_t i = index->size; i < o.size(); i++) {
+                index_member(o, index, i);
+            }
+            index->size = o.size();
         }
 
-        for (auto& it : *value.object) {
-            if (it.first == k) {
-                return it.second;
+        member_index::slot* slots = index->slots();
+        size_t mask = index->capacity - 1;
+        for (size_t i = hash & mask; slots[i].position; i = (i + 1) & mask) {
+            if (slots[i].hash != hash) {
+                continue;
+            }
+            auto& entry = o[slots[i].position - 1];
+            if (same_key(entry, key, size)) {
+                return &entry.second;
             }
         }
+        return nullptr;
+    }
 
-        // owned_objects own the names in the object array
-        if (type == value_t::object) {
-            assert(arena_);
-            string_t name = alloc_string(k, arena_);
-            value.object->emplace_back(std::move(name), json(arena_));
+    static member_index* build_index(object_t& o) {
+        o.drop_index();
+        // A quarter full, so the object can double before the next rebuild
+        size_t capacity = 64;
+        while (capacity < o.size() * 4) {
+            capacity *= 2;
+        }
+        size_t bytes = sizeof(member_index) + capacity * sizeof(member_index::slot);
+        arena_allocator* arena = o.get_allocator().arena;
+        void* memory = arena ? arena->alloc(bytes, alignof(member_index)) : malloc(bytes);
+        member_index* index = new(memory) member_index{0, capacity, !arena};
+        memset(static_cast<void*>(index->slots()), 0, capacity * sizeof(member_index::slot));
+        for (size_t i = 0; i < o.size(); i++) {
+            index_member(o, index, i);
+        }
+        index->size = o.size();
+        o.index_ = index;
+        return index;
+    }
+
+    // Equal keys follow one another along a probe sequence, so lookups find the first as a scan would
+    static void index_member(object_t& o, member_index* index, size_t i) {
+        uint32_t hash = member_hash(o[i].first.data, o[i].first.size);
+        member_index::slot* slots = index->slots();
+        size_t mask = index->capacity - 1;
+        size_t j = hash & mask;
+        while (slots[j].position) {
+            j = (j + 1) & mask;
+        }
+        slots[j] = member_index::slot{static_cast<uint32_t>(i + 1), hash};
+    }
+
+    void become_object() {
+        assert(is_null());
+        if (arena_) {
+            type = value_t::object;
+            value.object = alloc_object(arena_);
         } else {
-            assert(type == value_t::owned_object);
-            string_t name = alloc_string(k);
-            value.object->emplace_back(std::move(name), json(arena_));
+            type = value_t::owned_object;
+            value.object = new object_t();
         }
-        return value.object->back().second;
+    }
+    
+    json& operator[](const char* k) {
+        return member(k, std::strlen(k));
+    }
+
+    // Keys from the key_table a document was interned with are found by their pointer
+    json& operator[](const string_t& k) {
+        return member(k.data, k.size);
+    }
+
+    json& operator[](const std::string& k) {
+        return member(k.data(), k.size());
     }
 
     template<typename ValueT, typename ObjectItT, typename ArrayItT>
@@ -1026,11 +1988,18 @@ public:
         else return const_iterator();
     }
 
+    // Hands out the members themselves, so the object's index is dropped whenever they are
     struct items_proxy {
         object_t& o;
 
-        object_t::iterator begin() { return o.begin(); }
-        object_t::iterator end() { return o.end(); }
+        object_t::iterator begin() {
+            o.drop_index();
+            return o.begin();
+        }
+        object_t::iterator end() {
+            o.drop_index();
+            return o.end();
+        }
         object_t::const_iterator begin() const { return o.cbegin(); }
         object_t::const_iterator end() const { return o.cend(); }
         object_t::const_iterator cbegin() { return o.cbegin(); }
@@ -1039,326 +2008,309 @@ public:
 
     items_proxy items() {
         if (is_object()) {
+            value.object->drop_index();
             return {*value.object};
         }
         std::abort();
     }
 
-    static result<json, const char*> parse(const std::string& s) {
-        json root = json::doc();
-        const char* c = s.data();
-        const char* cend = c + s.size();
+    static result<json, const char*> parse(const std::string& s, parse_flags flags = parse_flags::none) {
+        return parse(s.data(), s.size(), flags);
+    }
 
-        auto parse_value = [&]() -> result<json, const char*> {
-            c = skip_whitespace(c, cend);
-            if (c == cend) {
-                return error<const char*>("Unexpected end of string while parsing value");
-            }
-            switch (*c) {
-                case '{': // Begin object
-                    c = skip_whitespace(c + 1, cend);
-                    return json::object(root.arena());
-                case '[': // Begin array
-                    c = skip_whitespace(c + 1, cend);
-                    return json::array();
-                case '"': { // Begin String
-                    auto ps = parse_string(&c, cend, root.arena());
-                    if (!ps) {
-                        return error<const char*>(ps.error());
-                    }
-                    assert(*c == '"');
-                    c = skip_whitespace(c + 1, cend);
-                    return json(std::move(ps).value());
-                }
-                case 't': // begin true
-                    if (cend - c < 4) {
-                        c += cend - c;
-                        return error<const char*>("Unexpected value");
-                    } else if (c[1] == 'r' && c[2] == 'u' && c[3] == 'e') {
-                        c = skip_whitespace(c + 4, cend);
-                        return json(true);
-                    } else {
-                        c += 4;
-                        return error<const char*>("Unexpected value");
-                    }
-                    break;
-                case 'f': // Begin false
-                    if (cend - c < 5) {
-                        c += cend - c;
-                        return error<const char*>("Unexpected value");
-                    } else if (c[1] == 'a' && c[2] == 'l' && c[3] == 's' && c[4] == 'e') {
-                        c = skip_whitespace(c + 5, cend);
-                        return json(false);
-                    } else {
-                        c += 5;
-                        return error<const char*>("Unexpected value");
-                    }
-                    break;
-                case 'n': // begin null
-                    if (cend - c < 4) {
-                        c += cend - c;
-                        return error<const char*>("Unexpected value");
-                    } else if (c[1] == 'u' && c[2] == 'l' && c[3] == 'l') {
-                        c = skip_whitespace(c + 4, cend);
-                        return json();
-                    } else {
-                        c += 4;
-                        return error<const char*>("Unexpected value");
-                    }
-                    break;
-                case '-':
-                case '0':
-                case '1':
-                case '2':
-                case '3':
-                case '4':
-                case '5':
-                case '6':
-                case '7':
-                case '8':
-                case '9': { // begin number
-                    parsed_number n = parse_number(c, cend);
-                    switch (n.type) {
-                        case number_t::int_num:
-                            c = n.end;
-                            c = skip_whitespace(c, cend);
-                            return json(n.i);
-                        case number_t::uint_num:
-                            c = n.end;
-                            c = skip_whitespace(c, cend);
-                            return json(n.u);
-                        case number_t::real_num:
-                            c = n.end;
-                            c = skip_whitespace(c, cend);
-                            return json(n.d);
-                        case number_t::error:
-                            return error<const char*>(n.what);
-                    }
-                    break;
-                }
-                default:
-                    break;
-            }
-            return error<const char*>("Unexpected token");
-        };
+#if __cplusplus >= 201703L
+    static result<json, const char*> parse(std::string_view s, parse_flags flags = parse_flags::none) {
+        return parse(s.data(), s.size(), flags);
+    }
+#endif
 
-        // Structures holds in-progress structures (objects or array)
-        // and a count of the number of elements parsed so far.
-        std::stack<std::pair<json*, size_t>> structures;
-        // Holds Name-Value pairs for objects being constructed
-        std::deque<std::pair<string_t, json>> object_parts;
-        // Holds values for arrays being constructed
-        std::deque<json> array_parts;
-
-        // JSON docs can be single values all by themselves
-        {
-            result<json, const char*> value = parse_value();
-            if (!value) {
-                return value;
-            } else if (!(value.value().is_object() || value.value().is_array())) {
-                // Expect a single value document
-                c = skip_whitespace(c, cend);
-                if (c != cend) {
-                    return error<const char*>("Unexpected character:");
-                }
-                return value;
-            }
+    // Parses a null-terminated string
+    static result<json, const char*> parse(const char* s, parse_flags flags = parse_flags::none) {
+        return parse(s, std::strlen(s), flags);
+    }
 
-            // Array or Object
-            root = std::move(value).value();
-            assert(root.arena());
-            structures.emplace(&root, 0);
-        }
+    /*
+     * Maps the file at path into memory and parses it without reading it into a buffer first.
+     * With parse_flags::insitu the document keeps the mapping alive for its strings to point into,
+     * otherwise the file is unmapped before returning. Nothing is read past the end of the file, so
+     * it needs no terminator. Defined in json.cpp
+     */
+    static result<json, const char*> parse_file(const char* path, parse_flags flags = parse_flags::none);
 
-        auto end_array_or_object = [&structures, &object_parts, &array_parts]() {
-            assert(!structures.empty());
-            assert(structures.top().first->is_array() || structures.top().first->is_object());
-            if (structures.top().second == 0) {
-                structures.pop();
-                return;
-            }
-            auto a_or_o_size = structures.top();
-            structures.pop();
-           
-            json* a_or_o = a_or_o_size.first;
-            size_t size = a_or_o_size.second;
-
-            if (a_or_o->is_object()) {
-                auto& obj_vec = *a_or_o->value.object;
-                assert(obj_vec.empty());
-                obj_vec.insert(obj_vec.end(),
-                               std::make_move_iterator(object_parts.end() - size),
-                               std::make_move_iterator(object_parts.end()));
-                object_parts.erase(object_parts.end() - size, object_parts.end());
-            } else {
-                assert(a_or_o->is_array());
-                auto& arr_vec = *a_or_o->value.array;
-                assert(arr_vec.empty());
-                arr_vec.insert(arr_vec.end(),
-                               std::make_move_iterator(array_parts.end() - size),
-                               std::make_move_iterator(array_parts.end()));
-                array_parts.erase(array_parts.end() - size, array_parts.end());
-            }
-        };
+    static result<json, const char*> parse_file(const std::string& path, parse_flags flags = parse_flags::none) {
+        return parse_file(path.c_str(), flags);
+    }
 
-        while (!structures.empty()) {
-            // Parse Array
-            // Arrays are lists of Values.
-            // Commas "," separate Values.
-            // [ value, value2, ... ]
-            //  ^
+    /*
+     * Parses a document that is one large array on several threads. The array is split between its
+     * top-level elements, the pieces are parsed concurrently into arenas of their own and the elements
+     * are gathered into one array. Other documents, small ones and malformed ones go to parse.
+     * threads = 0 uses one per hardware thread. Defined in json.cpp
+     */
+    static result<json, const char*> parse_parallel(const char* buf, size_t len, parse_flags flags = parse_flags::none,
+                                                    unsigned threads = 0);
 
-            assert(structures.top().first->is_array() || structures.top().first->is_object());
-            if (structures.top().first->is_array()) {
-                if (structures.top().second > 0) {
-                    c = skip_whitespace(c, cend);
-                    // [ value, value2, ... ]
-                    //                      ^
-                    if (c != cend && *c == ']') {
-                        c++;
-                        end_array_or_object();
-                        continue;
-                    }
+    static result<json, const char*> parse_parallel(const std::string& s, parse_flags flags = parse_flags::none,
+                                                    unsigned threads = 0) {
+        return parse_parallel(s.data(), s.size(), flags, threads);
+    }
 
-                    // [ value, value2, ... ]
-                    //        ^
-                    if (c == cend || *c != ',') {
-                        return error<const char*>("Expected ','");
-                    }
-                    c++;
-                }
+    /*
+     * Parses len bytes starting at buf and reports what it finds to handler instead of building a
+     * document. Handler has the members of sax_handler, each returning false to stop the parse.
+     * Strings and keys are only valid during the call they are passed to.
+     * Returns true once the whole document is parsed, false if the handler stopped it.
+     */
+    template <typename Handler>
+    static result<bool, const char*> parse_sax(const char* buf, size_t len, Handler& handler, parse_flags flags = parse_flags::none);
 
-                // [ value, value2, ... ]
-                //   ^
-                result<json, const char*> value = parse_value();
-                if (!value) {
-                    // [ value, value2, ... ]
-                    //                      ^
-                    if (c != cend && *c == ']') {
-                        c++;
-                        end_array_or_object();
-                        continue;
-                    }
-                    return error<const char*>(value.error());
-                } else if (value.value().is_object() || value.value().is_array()) {
-                    // Structues will be: |new_struct*, 0   | <- top
-                    //                    |array*,      n+1 |
-                    structures.top().second += 1;
-                    array_parts.emplace_back(std::move(value).value());
-                    structures.emplace(&array_parts.back(), 0);
-                    continue;
-                } else {
-                    structures.top().second += 1;
-                    array_parts.emplace_back(std::move(value).value());
-                    continue;
-                }
-            } else {
-                // Parse Object
-                // Objects are unordered sets of Name-Value pairs.
-                // Names must be Strings.
-                // Colons ":" separate Names and Values.
-                // Commas "," separate Name-Value pairs.
-                // { "name": value, "name2": value2, ... }
-                //  ^
-
-                assert(structures.top().first->is_object());
-
-                if (structures.top().second > 0) {
-                    // { "name": value, "name2": value2, ... }
-                    //                                       ^
-                    c = skip_whitespace(c, cend);
-                    if (c != cend && *c == '}') {
-                        c++;
-                        end_array_or_object();
-                        continue;
-                    }
+    template <typename Handler>
+    static result<bool, const char*> parse_sax(const std::string& s, Handler& handler, parse_flags flags = parse_flags::none) {
+        return parse_sax(s.data(), s.size(), handler, flags);
+    }
 
-                    // { "name": value, "name2": value2, ... }
-                    //                ^
-                    if (c == cend || *c != ',') {
-                        return error<const char*>("Expected ','");
-                    }
-                    c++;
-                }
+    /*
+     * Parses only the values at the given JSON Pointers (RFC 6901), e.g. "/user/id", into a document
+     * that keeps them under the same object keys. Everything else is skipped by counting brackets in
+     * the structural index without being decoded or validated. Arrays on the way to a path keep only
+     * the elements on one, in order, so their indices are renumbered: with "/items/2/v" as the only
+     * path the value ends up at "/items/0/v". Paths that aren't in the document are left out.
+     */
+    static result<json, const char*> parse_paths(const char* buf, size_t len, const std::vector<std::string>& paths,
+                                                 parse_flags flags = parse_flags::none);
 
-                c = skip_whitespace(c, cend);
-                if (c == cend) {
-                    return error<const char*>("Unexpected end of string while parsing Key");
-                }
+    static result<json, const char*> parse_paths(const std::string& s, const std::vector<std::string>& paths,
+                                                 parse_flags flags = parse_flags::none) {
+        return parse_paths(s.data(), s.size(), paths, flags);
+    }
 
-                if (*c == '}') {
-                    // { "name": value, "name2": value2, ... }
-                    //                                       ^
-                    c++;
-                    end_array_or_object();
-                    continue;
-                } else if (*c != '"') {
-                    return error<const char*>("Expected start of String for Key");
-                }
+    /*
+     * Parses until the values at all of the given JSON Pointers are complete and returns the document
+     * as far as it got, with the objects and arrays that were still open closed where it stopped.
+     * The input is only indexed as far as parsing gets, and nothing after that point is looked at, so
+     * a document that is malformed or truncated further on is accepted. If a path isn't in the
+     * document it is parsed and validated to the end like json::parse.
+     */
+    static result<json, const char*> parse_until(const char* buf, size_t len, const std::vector<std::string>& paths,
+                                                 parse_flags flags = parse_flags::none);
 
-                // { "name": value, "name2": value2, ... }
-                //   ^
-                string_t key;
-                auto ps = parse_string(&c, cend, root.arena());
-                if (!ps) {
-                    return error<const char*>(ps.error());
-                }
-                assert(*c == '"');
-                c++;
-                key = std::move(ps).value();
+    static result<json, const char*> parse_until(const std::string& s, const std::vector<std::string>& paths,
+                                                 parse_flags flags = parse_flags::none) {
+        return parse_until(s.data(), s.size(), paths, flags);
+    }
 
-                // { "name": value, "name2": value2, ... }
-                //         ^
-                c = skip_whitespace(c, cend);
-                if (c == cend || *c != ':') {
-                    return error<const char*>("Expected ':'");
-                }
-                c++;
-                c = skip_whitespace(c, cend);
+    /*
+     * Parses len bytes starting at buf and decodes escaped strings over the input, which is left
+     * unusable as JSON. Every string in the result points into buf, so buf must outlive the document.
+     */
+    static result<json, const char*> parse_inplace(char* buf, size_t len, parse_flags flags = parse_flags::none) {
+        return parse(buf, len, flags | parse_flags::insitu | parse_flags_inplace);
+    }
 
-                // { "name": value, "name2": value2, ... }
-                //           ^
-                result<json, const char*> value = parse_value();
-                if (!value) {
-                    return error<const char*>(value.error());
-                } else if (value.value().is_object() || value.value().is_array()) {
-                    // Structues will be: |new_struct*, 0   | <- top
-                    //                    |object*,     n+1 |
-                    structures.top().second += 1;
-                    object_parts.emplace_back(std::move(key), std::move(value).value());
-                    structures.emplace(&object_parts.back().second, 0);
-                    continue;
-                } else {
-                    // We parsed a Name and a non-object, non-array Value
-                    structures.top().second += 1;
-                    object_parts.emplace_back(std::move(key), std::move(value).value());
-                    continue;
-                }
-            }
-        }
+    // Parses len bytes starting at buf. The buffer is not copied and needs no terminator or padding.
+    // Strings in the result are copied into the document, so buf may be released once this returns,
+    // unless flags has parse_flags::insitu.
+    static result<json, const char*> parse(const char* buf, size_t len, parse_flags flags = parse_flags::none) {
+        return parse_buffer(buf, len, flags, nullptr);
+    }
 
-        c = skip_whitespace(c, cend);
-        if (c != cend) {
-            return error<const char*>("Unexpected character");
-        }
+    // Parses with parse_flags::intern_keys. Keys found in keys point at its copies instead of being
+    // copied, the rest are interned in the document. keys is only read and must outlive the document
+    static result<json, const char*> parse(const char* buf, size_t len, const key_table& keys,
+                                           parse_flags flags = parse_flags::none) {
+        return parse_buffer(buf, len, flags | parse_flags::intern_keys, &keys);
+    }
 
-        return root;
+    static result<json, const char*> parse(const std::string& s, const key_table& keys,
+                                           parse_flags flags = parse_flags::none) {
+        return parse(s.data(), s.size(), keys, flags);
     }
 
 //private:
     // Parsing
     using parsed_string = result<string_t, const char*>;
 
+    struct dom_builder;
+
+    // Stage 2 position: the next value or structural character and what is left of the index
+    struct structural_cursor {
+        const char* buf;
+        const char* c;
+        const char* cend;
+        const uint32_t* next;
+        const uint32_t* last;
+
+        structural_cursor(const char* buf, size_t len, const structural_index& index)
+            : buf(buf), c(buf), cend(buf + len), next(index.positions), last(index.positions + index.size) {}
+
+        // Jump to the next structural character or start of a value.
+        // Everything in between is whitespace.
+        void advance() {
+            c = next != last ? buf + *next++ : cend;
+        }
+
+        bool at_end() const {
+            return next == last;
+        }
+    };
+
+    // Parses the value starting at s.c. Objects and arrays are returned empty, their elements
+    // are left to parse_document
+    static result<json, const char*> parse_value(structural_cursor& s, arena_allocator* arena, parse_flags flags);
+
+    static result<json, const char*> parse_buffer(const char* buf, size_t len, parse_flags flags,
+                                                  const key_table* shared_keys);
+
+    // Parses the key at s.c and interns it in builder's key table
+    static parsed_string parse_interned_key(structural_cursor& s, dom_builder& builder, parse_flags flags);
+
+    // Upper bound on the arena a document takes, for parse_flags::exact_size
+    static size_t measure_arena(const char* buf, size_t len, const structural_index& index, parse_flags flags);
+
+    // Parses the value at the next structural into builder, leaving s just past its end
+    static result<bool, const char*> parse_document(structural_cursor& s, dom_builder& builder, parse_flags flags) {
+        no_watch watch;
+        return parse_document(s, builder, flags, watch);
+    }
+
+    /*
+     * parse_document that shows watch every value as it is added with root(value), member(key, value)
+     * or element(index, value), and calls end() when an object or array closes. Returning false from
+     * any of them stops the parse, which returns false and leaves the open structures in builder.
+     */
+    template <typename Watch>
+    static result<bool, const char*> parse_document(structural_cursor& s, dom_builder& builder, parse_flags flags,
+                                                    Watch& watch);
+
+    struct no_watch {
+        bool root(const json&) { return true; }
+        bool member(const string_t&, const json&) { return true; }
+        bool element(size_t, const json&) { return true; }
+        bool end() { return true; }
+    };
+
+    // parse_sax over an index that is already built
+    template <typename Handler>
+    static result<bool, const char*> parse_sax(structural_cursor& s, Handler& handler, parse_flags flags);
+
+    // The paths given to parse_paths as a tree. Children are indices into the same vector
+    struct path_node {
+        std::string name;
+        // Everything under here was asked for
+        bool whole = false;
+        std::vector<size_t> children;
+    };
+
+    // Adds paths to nodes, which starts out holding just the root. Returns an error or nullptr
+    static const char* build_path_tree(const std::vector<std::string>& paths, std::vector<path_node>& nodes);
+
+    // Stops parse_until once the values at every path are complete
+    struct path_watch;
+
+    // Whether a value built by select_paths holds anything that was asked for
+    static bool selected_anything(const json& j) {
+        return !j.is_null() && !((j.is_object() || j.is_array()) && j.empty());
+    }
+
+    static const char* select_paths(const ondemand_document& doc, const std::vector<path_node>& nodes, size_t node,
+                                    size_t i, json& out, parse_flags flags);
+
+    /*
+     * Stage 1 of parsing.
+     * Classifies the input 64 bytes at a time and records the offset of every structural
+     * character ({}[]:,) and the first byte of every value outside of strings.
+     * Stage 2 (json::parse) then jumps between these offsets instead of walking the whitespace
+     * between them, and only looks at the bytes of the values themselves.
+     * Offsets are 32 bits wide, so documents are limited to 4 GiB.
+     */
+    static bool find_structurals(const char* buf, size_t len, structural_index& index) {
+        index.clear();
+        if (len > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+
+        uint64_t prev_escaped = 0;
+        uint64_t prev_in_string = 0;
+        uint64_t prev_scalar = 0;
+
+        auto index_block = [&](const char* block, uint32_t offset) {
+            simd::block_masks m = simd::classify(block);
+
+            uint64_t escaped = simd::find_escaped(m.backslash, prev_escaped);
+            uint64_t quote = m.quote & ~escaped;
+            // Set for opening quotes and string contents but not closing quotes
+            uint64_t in_string = simd::prefix_xor(quote) ^ prev_in_string;
+            prev_in_string = 0 - (in_string >> 63);
+            uint64_t string_tail = in_string ^ quote;
+
+            // Values start at the first non-whitespace, non-structural character of a run.
+            // Quotes end runs so that "a""b" yields two starts (and an error in stage 2).
+            uint64_t scalar = ~(m.op | m.whitespace);
+            uint64_t nonquote_scalar = scalar & ~quote;
+            uint64_t follows_nonquote_scalar = (nonquote_scalar << 1) | prev_scalar;
+            prev_scalar = nonquote_scalar >> 63;
+            uint64_t structurals = (m.op | (scalar & ~follows_nonquote_scalar)) & ~string_tail;
+
+            index.reserve(index.size + 64);
+            uint32_t* out = index.positions + index.size;
+            while (structurals) {
+                *out++ = offset + simd::trailing_zeroes(structurals);
+                structurals &= structurals - 1;
+            }
+            index.size = static_cast<size_t>(out - index.positions);
+        };
+
+        size_t i = 0;
+        for (; i + 64 <= len; i += 64) {
+            index_block(buf + i, static_cast<uint32_t>(i));
+        }
+        if (i < len) {
+            // Pad the last block with whitespace
+            char block[64];
+            memset(block, ' ', sizeof(block));
+            memcpy(block, buf + i, len - i);
+            index_block(block, static_cast<uint32_t>(i));
+        }
+        return true;
+    }
+
+    // Numbers, true, false, and null must be followed by whitespace, a structural character, or the end of input
+    static inline bool ends_value(const char* c, const char* cend) {
+        if (c == cend) return true;
+        switch (*c) {
+            case ' ':
+            case '\n':
+            case '\r':
+            case '\t':
+            case ',':
+            case ':':
+            case '[':
+            case ']':
+            case '{':
+            case '}':
+                return true;
+            default:
+                return false;
+        }
+    }
+
     // Only called by parse_string when escape characters are found
-    static parsed_string parse_string_slow(const char* str_start, const char* str_end, arena_allocator* arena) {
-        // Reserve enough space for the output.
-        // At worst this is 6x larger than it needs to be because the entire string could be
-        // 6 char length hex codes which map to 1 byte utf-8 codepoints (\u0041 == 'A')
-        size_t size = (str_end - str_start) * sizeof(char);
-        string_t ret = alloc_string(size, arena);
+    static parsed_string parse_string_slow(const char* str_start, const char* str_end, arena_allocator* arena, parse_flags flags) {
+        string_t ret;
+        if (flags & parse_flags_inplace) {
+            // Every escape sequence decodes to fewer bytes than it takes up, so the output never
+            // overtakes the input and can be written over it
+            ret = string_t{const_cast<char*>(str_start), 0};
+        } else {
+            // Reserve enough space for the output.
+            // At worst this is 6x larger than it needs to be because the entire string could be
+            // 6 char length hex codes which map to 1 byte utf-8 codepoints (\u0041 == 'A')
+            size_t size = (str_end - str_start) * sizeof(char);
+            ret = alloc_string(size, arena);
+        }
 
         auto append = [&ret](const char* str, size_t count) {
-            memcpy(ret.data + ret.size, str, count);
+            memmove(ret.data + ret.size, str, count);
             ret.size += count;
         };
 
@@ -1487,62 +2439,70 @@ public:
 
     /*
      * We parse strings in a single pass in the common case and two passes worst-case.
-     * The first pass validates the string is UTF-8 and identifies the end of the string.
-     * If the string has no escape characters '\' the string is memcopied and returned.
-     * If any escape characters were identified during validation and length checking
-     * a second pass is performed to decode the string.
+     * The first pass finds the end of the string 64 bytes at a time using bitmasks of the quotes,
+     * backslashes, and control characters in each block. Quotes escaped by an odd run of
+     * backslashes are masked out, carrying runs from one block into the next.
+     * Strings with non-ASCII bytes are then UTF-8 validated in bulk.
+     * If the string has no escape characters '\\' the string is memcopied and returned, or with
+     * parse_flags::insitu returned as a view into the input.
+     * If any escape characters were identified a second pass is performed to decode the string,
+     * into the arena or, for parse_inplace, over the input.
      */
-    static parsed_string parse_string(const char** c, const char* cend, arena_allocator* arena) {
+    static parsed_string parse_string(const char** c, const char* cend, arena_allocator* arena, parse_flags flags) {
         assert(**c == '"');
         assert(arena);
         (*c)++;
         const char* str_start = *c;
+        const char* p = str_start;
         bool take_slow_path = false;
+        bool non_ascii = false;
+        uint64_t prev_escaped = 0;
 
         while (true) {
-            while (*c != cend && **c != '"') {
-                take_slow_path |= (**c == '\\');
-
-                // Naive UTF-8 validation
-                unsigned char byte_0 = **c;
-                int n = 0;
-                if (byte_0 <= 0x7F) n = 0;
-                else if ((byte_0 & 0xE0) == 0xC0) n = 1;
-                else if ((byte_0 & 0xF0) == 0xE0) n = 2;
-                else if ((byte_0 & 0xF8) == 0xF0) n = 3;
-                else return error<const char*>("Invalid UTF-8 codepoint");
-
-                (*c)++;
-                for (int i = 0; i < n; i++) {
-                    if ((*c + i) == cend || (((unsigned char)*(*c+i)) & 0xC0) != 0x80) return error<const char*>("Invalid UTF-8 codepoint");
-                }
-                (*c) += n;
-            }
-            if (*c == cend) {
-                return error<const char*>("Unexpected end of string when parsing string");
+            size_t remaining = static_cast<size_t>(cend - p);
+            simd::string_masks m;
+            if (remaining >= 64) {
+                m = simd::classify_string(p);
+            } else {
+                // Pad the last block with spaces, which never end a string
+                char block[64];
+                memset(block, ' ', sizeof(block));
+                memcpy(block, p, remaining);
+                m = simd::classify_string(block);
             }
 
-            if (!take_slow_path) {
-                assert(**c == '"');
-                size_t size = static_cast<size_t>(*c - str_start);
-                return alloc_string(str_start, size, arena);
+            uint64_t quote = m.quote & ~simd::find_escaped(m.backslash, prev_escaped);
+            // Everything before the closing quote, or the whole block
+            uint64_t body = quote ? (quote & (0 - quote)) - 1 : ~uint64_t(0);
+            if (m.control & body) {
+                return error<const char*>("Unescaped control character in string");
             }
+            take_slow_path |= (m.backslash & body) != 0;
+            non_ascii |= (m.non_ascii & body) != 0;
 
-            // We may not be at the end of the string yet as it may simply have been escaped
-            int escaped = 0;
-            const char* peek_back = (*c - 1);
-            while (peek_back != str_start - 1 && *peek_back == '\\') {
-                escaped ^= 1;
-                peek_back--;
+            if (quote) {
+                p += simd::trailing_zeroes(quote);
+                break;
+            }
+            if (remaining <= 64) {
+                *c = cend;
+                return error<const char*>("Unexpected end of string when parsing string");
             }
+            p += 64;
+        }
 
-            if (!escaped) {
-                assert(**c == '"');
-                return parse_string_slow(str_start, *c, arena);
+        *c = p;
+        if (non_ascii && !simd::validate_utf8(str_start, static_cast<size_t>(p - str_start))) {
+            return error<const char*>("Invalid UTF-8 codepoint");
+        }
+        if (!take_slow_path) {
+            size_t size = static_cast<size_t>(p - str_start);
+            if (flags & parse_flags::insitu) {
+                return string_t{const_cast<char*>(str_start), size};
             }
-            // Found an escaped quote, continue looking for end of string
-            (*c)++;
+            return alloc_string(str_start, size, arena);
         }
+        return parse_string_slow(str_start, p, arena, flags);
     }
 
     enum class number_t {
@@ -1602,18 +2562,197 @@ public:
         return false;
     }
 
+    // Truncated 128-bit approximations of 5^q for q in [-342, 308], high word first. See json.cpp
+    static const uint64_t power_of_five_128[];
+    static constexpr int64_t smallest_power_of_ten = -342;
+    static constexpr int64_t largest_power_of_ten = 308;
+
+    // Returns the high 64 bits of a * b and stores the low 64 bits in *low
+    static inline uint64_t full_multiplication(uint64_t a, uint64_t b, uint64_t* low) {
+    #if defined(__SIZEOF_INT128__)
+        __extension__ typedef unsigned __int128 uint128;
+        uint128 r = static_cast<uint128>(a) * b;
+        *low = static_cast<uint64_t>(r);
+        return static_cast<uint64_t>(r >> 64);
+    #else
+        uint64_t a_lo = a & 0xFFFFFFFF;
+        uint64_t a_hi = a >> 32;
+        uint64_t b_lo = b & 0xFFFFFFFF;
+        uint64_t b_hi = b >> 32;
+        uint64_t lo_lo = a_lo * b_lo;
+        uint64_t hi_lo = a_hi * b_lo;
+        uint64_t lo_hi = a_lo * b_hi;
+        uint64_t hi_hi = a_hi * b_hi;
+        uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+        *low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+        return (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    #endif
+    }
+
+    /*
+     * Eisel-Lemire: https://arxiv.org/abs/2101.11408
+     * Computes the correctly rounded double nearest to w * 10^q by multiplying w with a 128-bit
+     * approximation of 5^q. Returns false in the rare cases where the truncated product cannot
+     * decide the rounding and the caller has to fall back to strtod.
+     */
+    static bool compute_double_eisel_lemire(int64_t q, uint64_t w, double* d) {
+        const int mantissa_bits = 52;
+        const int64_t minimum_exponent = -1023;
+        const int64_t infinite_power = 0x7FF;
+
+        uint64_t mantissa = 0;
+        int64_t power2 = 0;
+        if (w == 0 || q < smallest_power_of_ten) {
+            // Rounds to zero
+        } else if (q > largest_power_of_ten) {
+            power2 = infinite_power;
+        } else {
+            int lz = __builtin_clzll(w);
+            w <<= lz;
+            const uint64_t* power = &power_of_five_128[2 * (q - smallest_power_of_ten)];
+            uint64_t low;
+            uint64_t high = full_multiplication(w, power[0], &low);
+            const uint64_t precision_mask = 0xFFFFFFFFFFFFFFFFull >> (mantissa_bits + 3);
+            if ((high & precision_mask) == precision_mask) {
+                // The bits below the mantissa are all ones, so the low word of 5^q may carry into them
+                uint64_t second_low;
+                uint64_t second_high = full_multiplication(w, power[1], &second_low);
+                low += second_high;
+                if (second_high > low) {
+                    high++;
+                }
+            }
+            if (low == 0xFFFFFFFFFFFFFFFFull && (q < -27 || q > 55)) {
+                // Outside of this range 5^q is not exact in 128 bits and the product may be off by one
+                return false;
+            }
+
+            int upperbit = static_cast<int>(high >> 63);
+            int shift = upperbit + 64 - mantissa_bits - 3;
+            mantissa = high >> shift;
+            // (217706 * q) >> 16 == floor(q * log2(10))
+            power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz - minimum_exponent;
+            if (power2 <= 0) {
+                // Subnormal
+                if (-power2 + 1 >= 64) {
+                    mantissa = 0;
+                    power2 = 0;
+                } else {
+                    mantissa >>= -power2 + 1;
+                    mantissa += mantissa & 1;
+                    mantissa >>= 1;
+                    power2 = mantissa < (uint64_t(1) << mantissa_bits) ? 0 : 1;
+                }
+            } else {
+                // Exactly halfway between two doubles only happens for small q. Round to even.
+                if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high) {
+                    mantissa &= ~uint64_t(1);
+                }
+                mantissa += mantissa & 1;
+                mantissa >>= 1;
+                if (mantissa >= (uint64_t(2) << mantissa_bits)) {
+                    mantissa = uint64_t(1) << mantissa_bits;
+                    power2++;
+                }
+                mantissa &= ~(uint64_t(1) << mantissa_bits);
+                if (power2 >= infinite_power) {
+                    mantissa = 0;
+                    power2 = infinite_power;
+                }
+            }
+        }
+        uint64_t bits = mantissa | (static_cast<uint64_t>(power2) << mantissa_bits);
+        std::memcpy(d, &bits, sizeof(double));
+        return true;
+    }
+
+    /*
+     * Converts a validated, unsigned real number to the nearest double.
+     * str..end is the number without its sign, u its significand with significant_digits digits (not
+     * counting leading zeros) and exponent the base 10 exponent that applies to u.
+     */
+    static double compute_real(const char* str, const char* end, uint64_t u, int64_t significant_digits,
+                               int64_t exponent) {
+        double d;
+        if (significant_digits <= 19) {
+            if (compute_double(exponent, u, &d) || compute_double_eisel_lemire(exponent, u, &d)) {
+                return d;
+            }
+        } else {
+            // u overflowed. Take the first 19 significant digits; if w and w + 1 round to the same
+            // double then so does every longer significand between them.
+            uint64_t w = 0;
+            int n = 0;
+            for (const char* p = str; n < 19; p++) {
+                if ((*p >= '1' && *p <= '9') || (*p == '0' && n > 0)) {
+                    w = w * 10 + (*p - '0');
+                    n++;
+                }
+            }
+            int64_t q = exponent + significant_digits - 19;
+            double d_next;
+            if (compute_double_eisel_lemire(q, w, &d) && compute_double_eisel_lemire(q, w + 1, &d_next) && d == d_next) {
+                return d;
+            }
+        }
+        return strtod_bounded(str, end);
+    }
+
+    // std::strtod of str..end. The input may go on past end, or stop there without a terminator, so
+    // the number is copied first. The copy also has the current locale's decimal point, which is what
+    // strtod expects
+    static double strtod_bounded(const char* str, const char* end) {
+        const char* point = std::localeconv()->decimal_point;
+        size_t point_size = std::strlen(point);
+        size_t size = static_cast<size_t>(end - str) + point_size + 1;
+        char local[128];
+        std::string heap;
+        char* copy = local;
+        if (size > sizeof(local)) {
+            heap.resize(size);
+            copy = &heap[0];
+        }
+        char* out = copy;
+        for (const char* p = str; p != end; p++) {
+            if (*p == '.') {
+                memcpy(out, point, point_size);
+                out += point_size;
+            } else {
+                *out++ = *p;
+            }
+        }
+        *out = '\0';
+        return std::strtod(copy, nullptr);
+    }
+
+    // digits..end is the integer part and u its value modulo 2^64
+    static inline parsed_number unsigned_integer(const char* digits, const char* end, uint64_t u) {
+        size_t n = static_cast<size_t>(end - digits);
+        if (n < 20 || (n == 20 && std::memcmp(digits, "18446744073709551615", 20) <= 0)) {
+            return parsed_number(end, u);
+        }
+        return parsed_number(end, "Overflow while parsing unsigned int");
+    }
+
+    static inline parsed_number signed_integer(const char* digits, const char* end, uint64_t u) {
+        if (end - digits <= 19 && u <= 9223372036854775808ull) {
+            return parsed_number(end, static_cast<int64_t>(0 - u));
+        }
+        return parsed_number(end, "Overflow while parsing signed int");
+    }
+
     static parsed_number parse_number(const char* str, const char* end) {
         enum class parse_phase {
             begin, // Allows '-' or any digit
-            unsigned_digits, // 1-9 or '.'
+            unsigned_digits, // After the integer digits. '.', 'e', or 'E' promotes to real
             signed_digits_1, // Follows leading '-'. Any digit but 0 promotes to real
-            signed_digits_2, // any digit, '.', 'e', or 'E' promotes to real
-            real_decimal, // Can only be '0.'
-            real_significand_1, // First digit of significand after '.'. Ignores leading 0s
-            real_significand_2, // significand after '.'
+            signed_digits_2, // After the integer digits. '.', 'e', or 'E' promotes to real
+            real_decimal, // Can only be '0.' or '0e'
+            real_significand_1, // First digit of significand after '.'. Must be a digit
+            real_significand_2, // After the significand digits. 'e' or 'E'
             real_exponent_1, // exponent immediatley after 'e' or 'E'. '+' or '-' or any digit
-            real_exponent_2, // any digit, 0s ignored
-            real_exponent_3, // any digit, 0s not ignored
+            real_exponent_2, // exponent after '+' or '-'. Must be a digit
+            real_exponent_3, // any digit
         };
 
         const char* c = str;
@@ -1622,11 +2761,14 @@ public:
 
         int sign = 1;
         uint64_t u = 0;
+        int64_t significant_digits = 0;
         int exponent_sign = 1;
         int64_t implicit_exponent = 0;
-        uint64_t explicit_exponent = 0;
+        int64_t explicit_exponent = 0;
         parse_phase phase = parse_phase::begin;
 
+        // Runs of digits are consumed whole by simd::parse_digits, which leaves c on the last digit
+        // so that the loop increment lands on the character after the run
         for (;c != cend;++c) {
             switch(phase) {
                 case parse_phase::begin:
@@ -1649,7 +2791,7 @@ public:
                         case '8':
                         case '9':
                             phase = parse_phase::unsigned_digits;
-                            u = u * 10 + (*c - '0');
+                            c = simd::parse_digits(c, cend, u) - 1;
                             break;
                         default:
                             return parsed_number(c, "Unexpected token when parsing number");
@@ -1658,32 +2800,18 @@ public:
                 case parse_phase::unsigned_digits:
                     // std::cout << "unsigned_digits\n";
                     switch(*c) {
-                        case '0':
-                        case '1':
-                        case '2':
-                        case '3':
-                        case '4':
-                        case '5':
-                        case '6':
-                        case '7':
-                        case '8':
-                        case '9':
-                            u = u * 10 + (*c - '0');
-                            break;
                         case '.':
+                            significant_digits = c - c_begin;
                             phase = parse_phase::real_significand_1;
                             break;
                         case 'e':
                         case 'E':
+                            significant_digits = c - c_begin;
                             phase = parse_phase::real_exponent_1;
                             break;
                         default:
                             // Return unsigned number
-                            if (c - c_begin <= 19 || (c - c_begin == 20 && u >= 10000000000000000000ull)) {
-                                return parsed_number(c, u);
-                            } else {
-                                return parsed_number(c, "Overflow while parsing unsigned int");
-                            }
+                            return unsigned_integer(c_begin, c, u);
                     }
                     break;
                 case parse_phase::signed_digits_1:
@@ -1702,7 +2830,7 @@ public:
                         case '8':
                         case '9':
                             phase = parse_phase::signed_digits_2;
-                            u = u * 10 + (*c - '0');
+                            c = simd::parse_digits(c, cend, u) - 1;
                             break;
                         default:
                             return parsed_number(c, "Expected digit after '-'");
@@ -1711,31 +2839,17 @@ public:
                 case parse_phase::signed_digits_2:
                     // std::cout << "signed_digits_2\n";
                     switch(*c) {
-                        case '0':
-                        case '1':
-                        case '2':
-                        case '3':
-                        case '4':
-                        case '5':
-                        case '6':
-                        case '7':
-                        case '8':
-                        case '9':
-                            u = u * 10 + (*c - '0');
-                            break;
                         case '.':
+                            significant_digits = c - c_begin - 1;
                             phase = parse_phase::real_significand_1;
                             break;
                         case 'e':
                         case 'E':
+                            significant_digits = c - c_begin - 1;
                             phase = parse_phase::real_exponent_1;
                             break;
                         default:
-                            if (u <= 9223372036854775808ull) {
-                                return parsed_number(c, -1 * static_cast<int64_t>(u));
-                            } else {
-                                return parsed_number(c, "Overflow while parsing signed int");
-                            }
+                            return signed_integer(c_begin + 1, c, u);
                     }
                     break;
                 case parse_phase::real_decimal:
@@ -1744,6 +2858,10 @@ public:
                         case '.':
                             phase = parse_phase::real_significand_1;
                             break;
+                        case 'e':
+                        case 'E':
+                            phase = parse_phase::real_exponent_1;
+                            break;
                         default:
                             return parsed_number(c, static_cast<int64_t>(0));
                     }
@@ -1751,7 +2869,6 @@ public:
                 case parse_phase::real_significand_1:
                     switch(*c) {
                         case '0':
-                            break;
                         case '1':
                         case '2':
                         case '3':
@@ -1760,65 +2877,41 @@ public:
                         case '6':
                         case '7':
                         case '8':
-                        case '9':
-                            implicit_exponent -= 1;
-                            u = u * 10 + (*c - '0');
+                        case '9': {
+                            if (significant_digits == 0) {
+                                // "0." so leading zeros are not significant
+                                const char* zeros = c;
+                                while (c != cend && *c == '0') {
+                                    c++;
+                                }
+                                implicit_exponent -= c - zeros;
+                            }
+                            const char* digits = c;
+                            c = simd::parse_digits(c, cend, u);
+                            implicit_exponent -= c - digits;
+                            significant_digits += c - digits;
+                            c--;
                             phase = parse_phase::real_significand_2;
                             break;
-                        case 'e':
-                        case 'E':
-                            phase = parse_phase::real_exponent_1;
-                            break;
+                        }
                         default:
-                            int64_t exponent = implicit_exponent + (explicit_exponent * exponent_sign);
-                            double d;
-                            if (compute_double(exponent, u, &d)) {
-                                return parsed_number(c, d * sign);
-                            } else {
-                                char* e;
-                                d = std::strtod(str, &e);
-                                return parsed_number(e, d);
-                            }
+                            return parsed_number(c, "Expected digit after '.'");
                     }
                     break;
                 case parse_phase::real_significand_2:
                     switch(*c) {
-                        case '0':
-                        case '1':
-                        case '2':
-                        case '3':
-                        case '4':
-                        case '5':
-                        case '6':
-                        case '7':
-                        case '8':
-                        case '9':
-                            implicit_exponent -= 1;
-                            u = u * 10 + (*c - '0');
-                            break;
                         case 'e':
                         case 'E':
                             phase = parse_phase::real_exponent_1;
                             break;
                         default:
-                            //return parsed_number(c, "Expected 'e', 'E' or digit after '.'");
-                            int64_t exponent = implicit_exponent + (explicit_exponent * exponent_sign);
-                            double d;
-                            if (compute_double(exponent, u, &d)) {
-                                return parsed_number(c, d * sign);
-                            } else {
-                                char* e;
-                                d = std::strtod(str, &e);
-                                return parsed_number(e, d);
-                            }
+                            return parsed_number(c, sign * compute_real(c_begin + (sign < 0), c, u,
+                                significant_digits, implicit_exponent + explicit_exponent * exponent_sign));
                     }
                     break;
                 case parse_phase::real_exponent_1:
                     switch (*c) {
                         case '0':
-                            // Ignore leading 0s
-                            phase = parse_phase::real_exponent_2;
-                            break;
                         case '1':
                         case '2':
                         case '3':
@@ -1828,16 +2921,16 @@ public:
                         case '7':
                         case '8':
                         case '9':
-                            explicit_exponent = explicit_exponent * 10 + (*c - '0');
+                            explicit_exponent = *c - '0';
                             phase = parse_phase::real_exponent_3;
                             break;
                         case '-':
                             exponent_sign = -1;
-                            phase = parse_phase::real_exponent_3;
+                            phase = parse_phase::real_exponent_2;
                             break;
                         case '+':
                             exponent_sign = 1;
-                            phase = parse_phase::real_exponent_3;
+                            phase = parse_phase::real_exponent_2;
                             break;
                         default:
                             return parsed_number(c, "Expected '+', '-', or digit while parsing exponent");
@@ -1846,8 +2939,6 @@ public:
                 case parse_phase::real_exponent_2:
                     switch (*c) {
                         case '0':
-                            // Ignore leading 0s
-                            break;
                         case '1':
                         case '2':
                         case '3':
@@ -1857,21 +2948,11 @@ public:
                         case '7':
                         case '8':
                         case '9':
-                            explicit_exponent = explicit_exponent * 10 + (*c - '0');
+                            explicit_exponent = *c - '0';
                             phase = parse_phase::real_exponent_3;
                             break;
-                        default: {
-                            // TODO: https://r-libre.teluq.ca/2259/1/floatparsing-11.pdf
-                            int64_t exponent = implicit_exponent + (explicit_exponent * exponent_sign);
-                            double d;
-                            if (compute_double(exponent, u, &d)) {
-                                return parsed_number(c, d * sign);
-                            } else {
-                                char* e;
-                                d = std::strtod(str, &e);
-                                return parsed_number(e, d);
-                            }
-                        }
+                        default:
+                            return parsed_number(c, "Expected digit after exponent sign");
                     }
                     break;
                 case parse_phase::real_exponent_3:
@@ -1887,20 +2968,14 @@ public:
                         case '7':
                         case '8':
                         case '9':
-                            explicit_exponent = explicit_exponent * 10 + (*c - '0');
-                            break;
-                        default: {
-                            // TODO: https://r-libre.teluq.ca/2259/1/floatparsing-11.pdf
-                            int64_t exponent = implicit_exponent + (explicit_exponent * exponent_sign);
-                            double d;
-                            if (compute_double(exponent, u, &d)) {
-                                return parsed_number(c, d * sign);
-                            } else {
-                                char* e;
-                                d = std::strtod(str, &e);
-                                return parsed_number(e, d);
+                            // Anything past 10^9 is 0 or infinity already. Stop accumulating so it can't overflow
+                            if (explicit_exponent < 1000000000) {
+                                explicit_exponent = explicit_exponent * 10 + (*c - '0');
                             }
-                        }
+                            break;
+                        default:
+                            return parsed_number(c, sign * compute_real(c_begin + (sign < 0), c, u,
+                                significant_digits, implicit_exponent + explicit_exponent * exponent_sign));
                     }
                     break;
             }
@@ -1912,41 +2987,24 @@ public:
                 return parsed_number(c, "Unexpected end of string while parsing number");
             case parse_phase::unsigned_digits:
                 // Return unsigned number
-                if (c - c_begin <= 19 || (c - c_begin == 20 && u >= 10000000000000000000ull)) {
-                    return parsed_number(c, u);
-                } else {
-                    return parsed_number(c, "Overflow while parsing unsigned int");
-                }
+                return unsigned_integer(c_begin, c, u);
             case parse_phase::signed_digits_1:
                 return parsed_number(c, "Expected digit after '-'");
             case parse_phase::signed_digits_2:
-                if (u <= 9223372036854775808ull) {
-                    return parsed_number(c, -1 * static_cast<int64_t>(u));
-                } else {
-                    return parsed_number(c, "Overflow while parsing signed int");
-                }
+                return signed_integer(c_begin + 1, c, u);
             case parse_phase::real_decimal:
                 return parsed_number(c, static_cast<int64_t>(0));
-            case parse_phase::real_exponent_1:
-                return parsed_number(c, "Expected digits after exponent signifier");
             case parse_phase::real_significand_1:
-                // fallthrough
-            case parse_phase::real_significand_2:
+                return parsed_number(c, "Expected digit after '.'");
+            case parse_phase::real_exponent_1:
                 // fallthrough
             case parse_phase::real_exponent_2:
+                return parsed_number(c, "Expected digits after exponent signifier");
+            case parse_phase::real_significand_2:
                 // fallthrough
-            case parse_phase::real_exponent_3: {
-                // TODO: https://r-libre.teluq.ca/2259/1/floatparsing-11.pdf
-                int64_t exponent = implicit_exponent + (explicit_exponent * exponent_sign);
-                double d;
-                if (compute_double(exponent, u, &d)) {
-                    return parsed_number(c, d * sign);
-                } else {
-                    char* e;
-                    d = std::strtod(str, &e);
-                    return parsed_number(e, d);
-                }
-            }
+            case parse_phase::real_exponent_3:
+                return parsed_number(c, sign * compute_real(c_begin + (sign < 0), c, u,
+                    significant_digits, implicit_exponent + explicit_exponent * exponent_sign));
         }
         return parsed_number(c, "parse_number fell through to end of function");
     }
@@ -1968,6 +3026,26 @@ public:
     }
 }; // class json
 
+inline object_t::object_t(const object_t& other) : base(other) {}
+
+inline object_t::object_t(object_t&& other) : base(std::move(other)) {}
+
+inline object_t& object_t::operator=(const object_t& other) {
+    base::operator=(other);
+    drop_index();
+    return *this;
+}
+
+inline object_t& object_t::operator=(object_t&& other) {
+    base::operator=(std::move(other));
+    drop_index();
+    return *this;
+}
+
+inline object_t::~object_t() {
+    drop_index();
+}
+
 template <>
 inline result<std::string, json_error> json::get<std::string>() const {
     if (is_string()) {
@@ -1976,6 +3054,15 @@ inline result<std::string, json_error> json::get<std::string>() const {
     return error<json_error>(json_error::invalid_type);
 }
 
+// The string without copying it. Points into the document, or into the input with parse_flags::insitu
+template <>
+inline result<string_t, json_error> json::get<string_t>() const {
+    if (is_string()) {
+        return value.string;
+    }
+    return error<json_error>(json_error::invalid_type);
+}
+
 template <>
 inline result<bool, json_error> json::get<bool>() const {
     if (is_boolean()) {
@@ -2084,5 +3171,2195 @@ inline result<double, json_error> json::get<double>() const {
     }
 }
 
-} // namespace fe
 
+/*
+ * Assembles parsed values into a document without recursion.
+ * Structures holds in-progress structures (objects or arrays) and a count of the number of elements
+ * parsed so far. Elements are collected in object_parts and array_parts and moved into their
+ * structure in one go when it ends. All three are contiguous stacks that keep their capacity, so
+ * a builder that is reused stops allocating once they are big enough. Elements move when the
+ * stacks grow, so structures find theirs by slot rather than by pointer.
+ */
+struct json::dom_builder {
+    // Where an open structure is held
+    enum class held_in: uint8_t {
+        root,
+        array_parts,
+        object_parts,
+    };
+
+    struct open_structure {
+        size_t slot;
+        size_t count;
+        held_in in;
+        bool is_array;
+    };
+
+    json root = json::doc();
+    scratch_stack<open_structure> structures;
+    // Holds Name-Value pairs for objects being constructed
+    scratch_stack<std::pair<string_t, json>> object_parts;
+    // Holds values for arrays being constructed
+    scratch_stack<json> array_parts;
+    // The document's keys with parse_flags::intern_keys, and a table to take them from first
+    key_table keys;
+    const key_table* shared_keys = nullptr;
+
+    dom_builder() = default;
+    // Builds into an arena owned by the caller
+    explicit dom_builder(arena_allocator* arena) : root(arena) {}
+    // Builds into an empty document
+    explicit dom_builder(json&& doc) : root(std::move(doc)) {}
+
+    arena_allocator* arena() const {
+        return root.arena();
+    }
+
+    // Destroys the document and anything left over from a failed parse. Scratch capacity is kept
+    void clear() {
+        structures.clear();
+        object_parts.clear();
+        array_parts.clear();
+        keys.clear();
+        root.destroy();
+        root.type = value_t::null;
+    }
+
+    // No structure is open: before the root value or after it has ended
+    bool done() const {
+        return structures.empty();
+    }
+
+    bool in_array() const {
+        return structures.data[structures.size - 1].is_array;
+    }
+
+    // Number of elements in the innermost structure so far
+    size_t count() const {
+        return structures.data[structures.size - 1].count;
+    }
+
+    // The first value of the document
+    void set_root(json&& value) {
+        // Strings live in the doc's arena, so the doc has to be what we return.
+        // Parsed values own nothing else and can be adopted as is
+        root.type = value.type;
+        root.value = value.value;
+        value.type = value_t::null;
+        open(root, held_in::root, 0);
+    }
+
+    void add_element(json&& value) {
+        structures.back().count += 1;
+        json& added = array_parts.emplace_back(std::move(value));
+        open(added, held_in::array_parts, array_parts.size - 1);
+    }
+
+    void add_member(string_t key, json&& value) {
+        structures.back().count += 1;
+        json& added = object_parts.emplace_back(key, std::move(value)).second;
+        open(added, held_in::object_parts, object_parts.size - 1);
+    }
+
+    // Moves the elements of the innermost structure into it and closes it
+    void end() {
+        assert(!structures.empty());
+        open_structure top = structures.back();
+        structures.pop_back();
+        if (top.count == 0) {
+            return;
+        }
+
+        json& a_or_o = top.in == held_in::root ? root
+                     : top.in == held_in::array_parts ? array_parts.data[top.slot]
+                     : object_parts.data[top.slot].second;
+        if (top.is_array) {
+            assert(a_or_o.is_array() && a_or_o.value.array->empty());
+            array_parts.move_back_to(*a_or_o.value.array, top.count);
+        } else {
+            assert(a_or_o.is_object() && a_or_o.value.object->empty());
+            object_parts.move_back_to(*a_or_o.value.object, top.count);
+        }
+    }
+
+private:
+    void open(const json& value, held_in in, size_t slot) {
+        if (value.is_object() || value.is_array()) {
+            structures.emplace_back(open_structure{slot, 0, in, value.is_array()});
+        }
+    }
+};
+
+inline result<json, const char*> json::parse_buffer(const char* buf, size_t len, parse_flags flags,
+                                                    const key_table* shared_keys) {
+    structural_index index;
+    if (!find_structurals(buf, len, index)) {
+        return error<const char*>("Document too large");
+    }
+    structural_cursor s(buf, len, index);
+    dom_builder builder(flags & parse_flags::exact_size ? json::doc(measure_arena(buf, len, index, flags)) : json::doc());
+    builder.shared_keys = shared_keys;
+
+    auto parsed = parse_document(s, builder, flags);
+    if (!parsed) {
+        return error<const char*>(parsed.error());
+    }
+    if (!s.at_end()) {
+        return error<const char*>("Unexpected character");
+    }
+
+    return std::move(builder.root);
+}
+
+inline json::parsed_string json::parse_interned_key(structural_cursor& s, dom_builder& builder, parse_flags flags) {
+    // Keys without escapes are looked up where they are in the input before anything is copied
+    auto key = parse_string(&s.c, s.cend, builder.arena(), flags | parse_flags::insitu);
+    if (!key) {
+        return key;
+    }
+    const string_t& k = key.value();
+    uint64_t hash = hash_key(k.data, k.size);
+    if (builder.shared_keys) {
+        string_t shared = builder.shared_keys->find(k.data, k.size, hash);
+        if (shared.data) {
+            return shared;
+        }
+    }
+    // Escaped keys have been decoded into the arena already
+    bool in_input = k.data >= s.buf && k.data < s.cend;
+    return builder.keys.intern(k.data, k.size, hash, in_input && !(flags & parse_flags::insitu) ? builder.arena() : nullptr);
+}
+
+inline size_t json::measure_arena(const char* buf, size_t len, const structural_index& index, parse_flags flags) {
+    // Strings and container headers are allocated at 16 byte alignment. Element storage comes in
+    // multiples of 16 bytes so it leaves the next allocation aligned
+    auto round_up = [](size_t n) { return (n + 15) & ~size_t(15); };
+    size_t containers = 0;
+    size_t colons = 0;
+    size_t values = 0;
+    size_t string_bytes = 0;
+    for (size_t i = 0; i < index.size; i++) {
+        switch (buf[index.positions[i]]) {
+            case '{':
+            case '[':
+                containers++;
+                values++;
+                break;
+            case '}':
+            case ']':
+            case ',':
+                break;
+            case ':':
+                colons++;
+                break;
+            case '"':
+                values++;
+                if (!(flags & parse_flags_inplace)) {
+                    // A string ends before the next structural, so this is at least its length
+                    size_t end = i + 1 < index.size ? index.positions[i + 1] : len;
+                    string_bytes += round_up(end - index.positions[i]);
+                }
+                break;
+            default:
+                values++;
+                break;
+        }
+    }
+    // Keys count as values in the index. Every value that isn't a key, a member's value or the
+    // root is an array element
+    size_t members = colons;
+    size_t elements = values > 2 * members + 1 ? values - 2 * members - 1 : 0;
+    return containers * round_up(sizeof(object_t)) + members * sizeof(object_t::value_type) +
+           elements * sizeof(json) + string_bytes;
+}
+
+inline result<json, const char*> json::parse_value(structural_cursor& s, arena_allocator* arena, parse_flags flags) {
+    const char*& c = s.c;
+    const char* cend = s.cend;
+    if (c == cend) {
+        return error<const char*>("Unexpected end of string while parsing value");
+    }
+    switch (*c) {
+        case '{': // Begin object
+            return json::object(arena);
+        case '[': // Begin array
+            return json::array(arena);
+        case '"': { // Begin String
+            auto ps = parse_string(&c, cend, arena, flags);
+            if (!ps) {
+                return error<const char*>(ps.error());
+            }
+            assert(*c == '"');
+            c++;
+            return json(std::move(ps).value());
+        }
+        case 't': // begin true
+            if (cend - c >= 4 && c[1] == 'r' && c[2] == 'u' && c[3] == 'e' && ends_value(c + 4, cend)) {
+                c += 4;
+                return json(true);
+            }
+            return error<const char*>("Unexpected value");
+        case 'f': // Begin false
+            if (cend - c >= 5 && c[1] == 'a' && c[2] == 'l' && c[3] == 's' && c[4] == 'e' && ends_value(c + 5, cend)) {
+                c += 5;
+                return json(false);
+            }
+            return error<const char*>("Unexpected value");
+        case 'n': // begin null
+            if (cend - c >= 4 && c[1] == 'u' && c[2] == 'l' && c[3] == 'l' && ends_value(c + 4, cend)) {
+                c += 4;
+                return json();
+            }
+            return error<const char*>("Unexpected value");
+        case '-':
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9': { // begin number
+            parsed_number n = parse_number(c, cend);
+            if (n.type == number_t::error) {
+                return error<const char*>(n.what);
+            }
+            c = n.end;
+            if (!ends_value(c, cend)) {
+                return error<const char*>("Unexpected character after number");
+            }
+            switch (n.type) {
+                case number_t::int_num:
+                    return json(n.i);
+                case number_t::uint_num:
+                    return json(n.u);
+                case number_t::real_num:
+                    return json(n.d);
+                case number_t::error:
+                    break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return error<const char*>("Unexpected token");
+}
+
+template <typename Watch>
+inline result<bool, const char*> json::parse_document(structural_cursor& s, dom_builder& builder, parse_flags flags,
+                                                      Watch& watch) {
+    const char*& c = s.c;
+    const char* cend = s.cend;
+    // JSON docs can be single values all by themselves
+    s.advance();
+    {
+        result<json, const char*> value = parse_value(s, builder.arena(), flags);
+        if (!value) {
+            return error<const char*>(value.error());
+        }
+        builder.set_root(std::move(value).value());
+        if (!watch.root(builder.root)) {
+            return false;
+        }
+    }
+
+    while (!builder.done()) {
+        // Parse Array
+        // Arrays are lists of Values.
+        // Commas "," separate Values.
+        // [ value, value2, ... ]
+        //  ^
+
+        if (builder.in_array()) {
+            s.advance();
+            // [ value, value2, ... ]
+            //                      ^
+            if (c != cend && *c == ']') {
+                builder.end();
+                if (!watch.end()) {
+                    return false;
+                }
+                continue;
+            }
+
+            if (builder.count() > 0) {
+                // [ value, value2, ... ]
+                //        ^
+                if (c == cend || *c != ',') {
+                    return error<const char*>("Expected ','");
+                }
+                s.advance();
+            }
+
+            // [ value, value2, ... ]
+            //   ^
+            result<json, const char*> value = parse_value(s, builder.arena(), flags);
+            if (!value) {
+                return error<const char*>(value.error());
+            }
+            size_t index = builder.count();
+            builder.add_element(std::move(value).value());
+            if (!watch.element(index, builder.array_parts.back())) {
+                return false;
+            }
+        } else {
+            // Parse Object
+            // Objects are unordered sets of Name-Value pairs.
+            // Names must be Strings.
+            // Colons ":" separate Names and Values.
+            // Commas "," separate Name-Value pairs.
+            // { "name": value, "name2": value2, ... }
+            //  ^
+
+            if (builder.count() > 0) {
+                // { "name": value, "name2": value2, ... }
+                //                                       ^
+                s.advance();
+                if (c != cend && *c == '}') {
+                    builder.end();
+                    if (!watch.end()) {
+                        return false;
+                    }
+                    continue;
+                }
+
+                // { "name": value, "name2": value2, ... }
+                //                ^
+                if (c == cend || *c != ',') {
+                    return error<const char*>("Expected ','");
+                }
+            }
+
+            s.advance();
+            if (c == cend) {
+                return error<const char*>("Unexpected end of string while parsing Key");
+            }
+
+            if (*c == '}' && builder.count() == 0) {
+                // { }
+                //   ^
+                builder.end();
+                if (!watch.end()) {
+                    return false;
+                }
+                continue;
+            } else if (*c != '"') {
+                return error<const char*>("Expected start of String for Key");
+            }
+
+            // { "name": value, "name2": value2, ... }
+            //   ^
+            auto key = flags & parse_flags::intern_keys ? parse_interned_key(s, builder, flags)
+                                                        : parse_string(&c, cend, builder.arena(), flags);
+            if (!key) {
+                return error<const char*>(key.error());
+            }
+            assert(*c == '"');
+
+            // { "name": value, "name2": value2, ... }
+            //         ^
+            s.advance();
+            if (c == cend || *c != ':') {
+                return error<const char*>("Expected ':'");
+            }
+
+            // { "name": value, "name2": value2, ... }
+            //           ^
+            s.advance();
+            result<json, const char*> value = parse_value(s, builder.arena(), flags);
+            if (!value) {
+                return error<const char*>(value.error());
+            }
+            builder.add_member(key.value(), std::move(value).value());
+            if (!watch.member(key.value(), builder.object_parts.back().second)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+template <typename Handler>
+inline result<bool, const char*> json::parse_sax(const char* buf, size_t len, Handler& handler, parse_flags flags) {
+    structural_index index;
+    if (!find_structurals(buf, len, index)) {
+        return error<const char*>("Document too large");
+    }
+    structural_cursor s(buf, len, index);
+    return parse_sax(s, handler, flags);
+}
+
+template <typename Handler>
+inline result<bool, const char*> json::parse_sax(structural_cursor& s, Handler& handler, parse_flags flags) {
+    // Strings without escapes are passed straight from the input. Escaped ones are decoded here
+    // and the space is reused for the next one
+    arena_allocator scratch;
+    flags = flags | parse_flags::insitu;
+
+    // Open structures, innermost last, and whether the innermost has had an element yet
+    std::vector<bool> in_array;
+    bool first = false;
+
+    s.advance();
+    for (;;) {
+        // { "name": value, ... } or [ value, ... ]
+        //           ^                 ^
+        if (s.c == s.cend) {
+            return error<const char*>("Unexpected end of string while parsing value");
+        }
+        bool more;
+        if (*s.c == '{') {
+            more = handler.on_start_object();
+            in_array.push_back(false);
+            first = true;
+        } else if (*s.c == '[') {
+            more = handler.on_start_array();
+            in_array.push_back(true);
+            first = true;
+        } else {
+            result<json, const char*> value = parse_value(s, &scratch, flags);
+            if (!value) {
+                return error<const char*>(value.error());
+            }
+            const json& v = value.value();
+            switch (v.type) {
+                case value_t::string:
+                    more = handler.on_string(v.value.string);
+                    scratch.reset();
+                    break;
+                case value_t::int_num:
+                    more = handler.on_int(v.value.int_num);
+                    break;
+                case value_t::uint_num:
+                    more = handler.on_uint(v.value.uint_num);
+                    break;
+                case value_t::float_num:
+                    more = handler.on_double(v.value.float_num);
+                    break;
+                case value_t::boolean:
+                    more = handler.on_bool(v.value.boolean);
+                    break;
+                default:
+                    more = handler.on_null();
+                    break;
+            }
+        }
+        if (!more) {
+            return false;
+        }
+
+        // Close finished structures and find the start of the next value
+        for (;;) {
+            if (in_array.empty()) {
+                if (!s.at_end()) {
+                    return error<const char*>("Unexpected character");
+                }
+                return true;
+            }
+            s.advance();
+            bool is_array = in_array.back();
+            if (s.c != s.cend && *s.c == (is_array ? ']' : '}')) {
+                in_array.pop_back();
+                first = false;
+                if (!(is_array ? handler.on_end_array() : handler.on_end_object())) {
+                    return false;
+                }
+                continue;
+            }
+
+            if (!first) {
+                if (s.c == s.cend || *s.c != ',') {
+                    return error<const char*>("Expected ','");
+                }
+                s.advance();
+            }
+            first = false;
+
+            if (!is_array) {
+                // { "name": value, "name2": value2, ... }
+                //   ^
+                if (s.c == s.cend) {
+                    return error<const char*>("Unexpected end of string while parsing Key");
+                } else if (*s.c != '"') {
+                    return error<const char*>("Expected start of String for Key");
+                }
+                auto key = parse_string(&s.c, s.cend, &scratch, flags);
+                if (!key) {
+                    return error<const char*>(key.error());
+                }
+                more = handler.on_key(key.value());
+                scratch.reset();
+                if (!more) {
+                    return false;
+                }
+
+                // { "name": value, "name2": value2, ... }
+                //         ^
+                s.advance();
+                if (s.c == s.cend || *s.c != ':') {
+                    return error<const char*>("Expected ':'");
+                }
+                s.advance();
+            }
+            break;
+        }
+    }
+}
+
+
+/*
+ * Parses one document after another and keeps its scratch space between them.
+ * The stage 1 index, the builder's stacks and the arena are emptied rather than freed, so once they
+ * have grown to fit, parsing more messages of the same size doesn't have to allocate them again.
+ * The document lives in the parser and is valid until the next parse() or clear().
+ *
+ *     fe::parser parser;
+ *     while (read_message(msg)) {
+ *         auto doc = parser.parse(msg);
+ *         if (doc) route(*doc.value());
+ *     }
+ */
+class parser {
+public:
+    parser() : builder_(&arena_) {}
+
+    parser(const parser&) = delete;
+    parser& operator=(const parser&) = delete;
+
+    // Parses len bytes starting at buf like json::parse, replacing the last document
+    result<json*, const char*> parse(const char* buf, size_t len, parse_flags flags = parse_flags::none);
+
+    result<json*, const char*> parse(const std::string& s, parse_flags flags = parse_flags::none) {
+        return parse(s.data(), s.size(), flags);
+    }
+
+    // Destroys the last document. Capacity is kept for the next one
+    void clear() {
+        builder_.clear();
+        arena_.reset();
+    }
+
+private:
+    arena_allocator arena_;
+    json::dom_builder builder_;
+    structural_index index_;
+};
+
+inline result<json*, const char*> parser::parse(const char* buf, size_t len, parse_flags flags) {
+    clear();
+    if (!json::find_structurals(buf, len, index_)) {
+        return error<const char*>("Document too large");
+    }
+    json::structural_cursor s(buf, len, index_);
+
+    auto parsed = json::parse_document(s, builder_, flags);
+    if (!parsed) {
+        return error<const char*>(parsed.error());
+    }
+    if (!s.at_end()) {
+        return error<const char*>("Unexpected character");
+    }
+    return &builder_.root;
+}
+
+/*
+ * Incremental parser for input that arrives in chunks, e.g. from a socket.
+ * feed() parses as much of each chunk as it can. When a string, number or literal runs past the end
+ * of a chunk only that token's bytes are kept, and parsing resumes inside it on the next feed().
+ * The document is assembled on the same explicit stack as json::parse so nothing is lost between
+ * chunks and nesting never recurses.
+ *
+ *     fe::push_parser parser;
+ *     while (size_t n = read_some(buf, sizeof(buf))) {
+ *         if (!parser.feed(buf, n)) break;
+ *     }
+ *     auto doc = parser.finish();
+ *
+ * Strings are always copied into the document since chunks don't outlive feed().
+ */
+class push_parser {
+public:
+    // Parses the next chunk. Returns true once the document is complete, false while it needs more
+    // input, or the first error. After an error every call returns it until finish() or reset().
+    result<bool, const char*> feed(const char* data, size_t len);
+
+    result<bool, const char*> feed(const std::string& data) {
+        return feed(data.data(), data.size());
+    }
+
+    // Ends the input and returns the document. The parser is then ready for the next one
+    result<json, const char*> finish();
+
+    void reset() {
+        builder_ = json::dom_builder();
+        expect_ = expect::value;
+        token_ = token_t::none;
+        escaped_ = false;
+        pending_.clear();
+        key_ = string_t{nullptr, 0};
+        error_ = nullptr;
+    }
+
+private:
+    // What the grammar allows next, ignoring whitespace
+    enum class expect : uint8_t {
+        value, // Any value
+        first_value, // A value or ']' right after '['
+        key, // A key after ','
+        first_key, // A key or '}' right after '{'
+        colon, // ':' after a key
+        comma, // ',' or the end of the innermost structure
+        end, // Nothing, the document is complete
+    };
+
+    // The kind of token suspended at the end of the previous chunk
+    enum class token_t : uint8_t {
+        none,
+        string,
+        key,
+        bare, // A number or literal
+    };
+
+    json::dom_builder builder_;
+    expect expect_ = expect::value;
+    token_t token_ = token_t::none;
+    // The last byte of a suspended string is a backslash that escapes the next one
+    bool escaped_ = false;
+    // The bytes of the suspended token
+    std::string pending_;
+    string_t key_ = string_t{nullptr, 0};
+    const char* error_ = nullptr;
+
+    error<const char*> fail(const char* what) {
+        error_ = what;
+        return error<const char*>(what);
+    }
+
+    // Returns the closing quote of a string body starting at c, or cend if the string continues
+    const char* find_string_end(const char* c, const char* cend) {
+        for (; c != cend; c++) {
+            if (escaped_) {
+                escaped_ = false;
+            } else if (*c == '\\') {
+                escaped_ = true;
+            } else if (*c == '"') {
+                return c;
+            }
+        }
+        return cend;
+    }
+
+    // Numbers and literals run until whitespace, a structural character or a quote
+    static const char* find_bare_end(const char* c, const char* cend) {
+        for (; c != cend; c++) {
+            switch (*c) {
+                case ' ':
+                case '\n':
+                case '\r':
+                case '\t':
+                case ',':
+                case ':':
+                case '[':
+                case ']':
+                case '{':
+                case '}':
+                case '"':
+                    return c;
+                default:
+                    break;
+            }
+        }
+        return cend;
+    }
+
+    // Parses the token starting at c if it ends within the chunk or suspends it until the next one.
+    // Returns where parsing continues
+    const char* start_token(token_t token, const char* c, const char* cend) {
+        const char* end;
+        bool suspended;
+        if (token == token_t::bare) {
+            end = find_bare_end(c, cend);
+            suspended = end == cend;
+        } else {
+            escaped_ = false;
+            end = find_string_end(c + 1, cend);
+            suspended = end == cend;
+            end++;
+        }
+        if (suspended) {
+            token_ = token;
+            pending_.assign(c, cend);
+            return cend;
+        }
+        complete_token(token, c, end);
+        return end;
+    }
+
+    // Parses a whole token. Strings include both quotes
+    void complete_token(token_t token, const char* begin, const char* end) {
+        if (token == token_t::string || token == token_t::key) {
+            const char* c = begin;
+            auto ps = json::parse_string(&c, end, builder_.arena(), parse_flags::none);
+            if (!ps) {
+                fail(ps.error());
+            } else if (token == token_t::key) {
+                key_ = ps.value();
+                expect_ = expect::colon;
+            } else {
+                add_value(json(ps.value()));
+            }
+            return;
+        }
+
+        size_t size = static_cast<size_t>(end - begin);
+        if (size == 0) {
+            fail("Unexpected token");
+            return;
+        }
+        switch (*begin) {
+            case 't':
+                if (size == 4 && memcmp(begin, "true", 4) == 0) {
+                    add_value(json(true));
+                    return;
+                }
+                break;
+            case 'f':
+                if (size == 5 && memcmp(begin, "false", 5) == 0) {
+                    add_value(json(false));
+                    return;
+                }
+                break;
+            case 'n':
+                if (size == 4 && memcmp(begin, "null", 4) == 0) {
+                    add_value(json());
+                    return;
+                }
+                break;
+            case '-':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9': {
+                json::parsed_number n = json::parse_number(begin, end);
+                if (n.type == json::number_t::error) {
+                    fail(n.what);
+                } else if (n.end != end) {
+                    fail("Unexpected character after number");
+                } else if (n.type == json::number_t::int_num) {
+                    add_value(json(n.i));
+                } else if (n.type == json::number_t::uint_num) {
+                    add_value(json(n.u));
+                } else {
+                    add_value(json(n.d));
+                }
+                return;
+            }
+            default:
+                fail("Unexpected token");
+                return;
+        }
+        fail("Unexpected value");
+    }
+
+    void add_value(json&& value) {
+        bool is_array = value.is_array();
+        bool is_object = value.is_object();
+        if (builder_.done()) {
+            builder_.set_root(std::move(value));
+        } else if (builder_.in_array()) {
+            builder_.add_element(std::move(value));
+        } else {
+            builder_.add_member(key_, std::move(value));
+        }
+        if (is_array) {
+            expect_ = expect::first_value;
+        } else if (is_object) {
+            expect_ = expect::first_key;
+        } else {
+            expect_ = builder_.done() ? expect::end : expect::comma;
+        }
+    }
+
+    void end_structure() {
+        builder_.end();
+        expect_ = builder_.done() ? expect::end : expect::comma;
+    }
+};
+
+inline result<bool, const char*> push_parser::feed(const char* data, size_t len) {
+    if (error_) {
+        return error<const char*>(error_);
+    }
+    const char* c = data;
+    const char* cend = data + len;
+
+    // Resume the token suspended at the end of the previous chunk
+    if (token_ != token_t::none) {
+        const char* end;
+        if (token_ == token_t::bare) {
+            end = find_bare_end(c, cend);
+            if (end == cend) {
+                pending_.append(c, cend);
+                return false;
+            }
+        } else {
+            end = find_string_end(c, cend);
+            if (end == cend) {
+                pending_.append(c, cend);
+                return false;
+            }
+            end++;
+        }
+        pending_.append(c, end);
+        token_t token = token_;
+        token_ = token_t::none;
+        complete_token(token, pending_.data(), pending_.data() + pending_.size());
+        pending_.clear();
+        c = end;
+    }
+
+    while (c != cend && !error_) {
+        switch (*c) {
+            case ' ':
+            case '\n':
+            case '\r':
+            case '\t':
+                c++;
+                continue;
+            default:
+                break;
+        }
+
+        switch (expect_) {
+            case expect::first_value:
+                if (*c == ']') {
+                    end_structure();
+                    c++;
+                    break;
+                }
+                // fallthrough
+            case expect::value:
+                if (*c == '[') {
+                    add_value(json::array(builder_.arena()));
+                    c++;
+                } else if (*c == '{') {
+                    add_value(json::object(builder_.arena()));
+                    c++;
+                } else if (*c == '"') {
+                    c = start_token(token_t::string, c, cend);
+                } else {
+                    // Validated once the whole token is known
+                    c = start_token(token_t::bare, c, cend);
+                }
+                break;
+            case expect::first_key:
+                if (*c == '}') {
+                    end_structure();
+                    c++;
+                    break;
+                }
+                // fallthrough
+            case expect::key:
+                if (*c != '"') {
+                    return fail("Expected start of String for Key");
+                }
+                c = start_token(token_t::key, c, cend);
+                break;
+            case expect::colon:
+                if (*c != ':') {
+                    return fail("Expected ':'");
+                }
+                expect_ = expect::value;
+                c++;
+                break;
+            case expect::comma:
+                if (*c == ',') {
+                    expect_ = builder_.in_array() ? expect::value : expect::key;
+                } else if (*c == (builder_.in_array() ? ']' : '}')) {
+                    end_structure();
+                } else {
+                    return fail("Expected ','");
+                }
+                c++;
+                break;
+            case expect::end:
+                return fail("Unexpected character");
+        }
+    }
+
+    if (error_) {
+        return error<const char*>(error_);
+    }
+    return expect_ == expect::end;
+}
+
+inline result<json, const char*> push_parser::finish() {
+    if (!error_ && token_ == token_t::bare) {
+        // The end of the input ends a number or literal
+        token_ = token_t::none;
+        complete_token(token_t::bare, pending_.data(), pending_.data() + pending_.size());
+    } else if (!error_ && token_ != token_t::none) {
+        fail("Unexpected end of string when parsing string");
+    }
+    if (!error_ && expect_ != expect::end) {
+        fail("Unexpected end of input");
+    }
+
+    if (error_) {
+        const char* what = error_;
+        reset();
+        return error<const char*>(what);
+    }
+    result<json, const char*> doc(std::move(builder_.root));
+    reset();
+    return doc;
+}
+
+/*
+ * Iterates over the documents in a buffer of concatenated or newline-delimited JSON (NDJSON).
+ * The buffer is indexed a batch of lines at a time and every document is parsed into the same
+ * arena and scratch space, so records cost no allocations of their own once those have grown.
+ *
+ *     fe::document_stream stream(buf, len);
+ *     while (stream.next()) {
+ *         if (stream.error()) {
+ *             log(stream.offset(), stream.error());
+ *             continue;
+ *         }
+ *         use(stream.value());
+ *     }
+ *
+ * A malformed record is reported and parsing resumes on the line after the one it started on.
+ * Each document is only valid until the next call to next(). The buffer must outlive the stream.
+ */
+class document_stream {
+public:
+    static constexpr size_t default_batch_size = 1 << 20;
+
+    // Documents are built in arena, if given, instead of one of the stream's own. They then outlive
+    // the calls to next() and can be moved out with take()
+    document_stream(const char* buf, size_t len, parse_flags flags = parse_flags::none, size_t batch_size = default_batch_size,
+                    arena_allocator* arena = nullptr)
+        : buf_(buf), len_(len), flags_(flags), batch_size_(batch_size), arena_(arena ? arena : &own_arena_),
+          builder_(arena_), s_(buf, 0, index_) {}
+
+    explicit document_stream(const std::string& s, parse_flags flags = parse_flags::none)
+        : document_stream(s.data(), s.size(), flags) {}
+    document_stream(std::string&&, parse_flags = parse_flags::none) = delete;
+
+    document_stream(const document_stream&) = delete;
+    document_stream& operator=(const document_stream&) = delete;
+
+    // Moves to the next document. Returns false once the input is used up
+    bool next();
+
+    // Why the current record failed to parse, or nullptr if it parsed
+    const char* error() const {
+        return error_;
+    }
+
+    // The current document. Only valid if error() is nullptr
+    json& value() {
+        assert(!error_);
+        return builder_.root;
+    }
+
+    // Where the current record starts in the buffer
+    size_t offset() const {
+        return offset_;
+    }
+
+    // Moves the current document out. Only for streams building into the caller's arena
+    json take() {
+        assert(!error_ && arena_ != &own_arena_);
+        json doc(arena_);
+        swap(doc, builder_.root);
+        return doc;
+    }
+
+private:
+    const char* buf_;
+    size_t len_;
+    parse_flags flags_;
+    size_t batch_size_;
+    arena_allocator own_arena_;
+    arena_allocator* arena_;
+    json::dom_builder builder_;
+    structural_index index_;
+    json::structural_cursor s_;
+    // The indexed part of the buffer
+    size_t window_start_ = 0;
+    size_t window_end_ = 0;
+    bool indexed_ = true;
+    size_t offset_ = 0;
+    const char* error_ = nullptr;
+
+    // Indexes the lines starting at start, batch_size_ bytes of them or a little more to finish a line
+    void index_window(size_t start) {
+        window_start_ = start;
+        window_end_ = len_;
+        if (len_ - start > batch_size_) {
+            const void* nl = memchr(buf_ + start + batch_size_, '\n', len_ - start - batch_size_);
+            if (nl) {
+                window_end_ = static_cast<size_t>(static_cast<const char*>(nl) - buf_) + 1;
+            }
+        }
+        indexed_ = json::find_structurals(buf_ + start, window_end_ - start, index_);
+        if (!indexed_) {
+            index_.clear();
+        }
+        s_ = json::structural_cursor(buf_ + start, window_end_ - start, index_);
+    }
+};
+
+inline bool document_stream::next() {
+    builder_.clear();
+    if (arena_ == &own_arena_) {
+        arena_->reset();
+    }
+    error_ = nullptr;
+
+    for (;;) {
+        if (s_.at_end()) {
+            if (!indexed_) {
+                // A line over 4 GiB. Skip it
+                indexed_ = true;
+                offset_ = window_start_;
+                error_ = "Document too large";
+                return true;
+            }
+            if (window_end_ == len_) {
+                return false;
+            }
+            index_window(window_end_);
+            continue;
+        }
+
+        offset_ = window_start_ + *s_.next;
+        auto parsed = json::parse_document(s_, builder_, flags_);
+        if (parsed) {
+            return true;
+        }
+
+        if (s_.at_end() && window_end_ < len_) {
+            // Ran out of index, so the document may carry on past the window. Retry it with a bigger one
+            builder_.clear();
+            if (arena_ == &own_arena_) {
+                arena_->reset();
+            }
+            batch_size_ *= 2;
+            index_window(offset_);
+            continue;
+        }
+
+        error_ = parsed.error();
+        // The index past a malformed record can't be trusted, e.g. after an unterminated string
+        const void* nl = memchr(buf_ + offset_, '\n', len_ - offset_);
+        index_window(nl ? static_cast<size_t>(static_cast<const char*>(nl) - buf_) + 1 : len_);
+        return true;
+    }
+}
+
+/*
+ * Parses newline-delimited JSON on several threads.
+ * The input is split at newlines into one chunk per thread, and each chunk is parsed by a
+ * document_stream into an arena of its own. Documents come back in input order and live as long
+ * as the batch. Defined in json.cpp
+ *
+ *     fe::document_batch docs(buf, len);
+ *     for (size_t i = 0; i < docs.size(); i++) {
+ *         if (docs.error(i)) continue;
+ *         use(docs[i]);
+ *     }
+ */
+class document_batch {
+public:
+    // Chunks are no smaller than this, so small inputs don't pay for threads they can't use
+    static constexpr size_t min_chunk_size = 1 << 20;
+
+    document_batch(const document_batch&) = delete;
+    document_batch(document_batch&&) = default;
+
+    // threads = 0 uses one per hardware thread. buf must outlive the batch with parse_flags::insitu
+    document_batch(const char* buf, size_t len, parse_flags flags = parse_flags::none, unsigned threads = 0);
+
+    // Maps the file at path and parses it the same way. With parse_flags::insitu the batch keeps
+    // the mapping alive for its strings to point into
+    static result<document_batch, const char*> parse_file(const char* path, parse_flags flags = parse_flags::none, unsigned threads = 0);
+
+    size_t size() const {
+        return size_;
+    }
+
+    // The i-th document in the input. Only valid if error(i) is nullptr
+    json& operator[](size_t i) {
+        return at(i).doc;
+    }
+
+    const json& operator[](size_t i) const {
+        return at(i).doc;
+    }
+
+    // Why the i-th record failed to parse, or nullptr if it parsed
+    const char* error(size_t i) const {
+        return at(i).error;
+    }
+
+    // Where the i-th record starts in the input
+    size_t offset(size_t i) const {
+        return at(i).offset;
+    }
+
+private:
+    struct record {
+        json doc;
+        const char* error;
+        size_t offset;
+    };
+
+    struct chunk {
+        // Declared first so the documents in it are destroyed before it
+        arena_allocator arena;
+        std::deque<record> records;
+        // Index of the first record in the batch
+        size_t first = 0;
+    };
+
+    std::deque<chunk> chunks_;
+    size_t size_ = 0;
+
+    document_batch() = default;
+    void parse(const char* buf, size_t len, parse_flags flags, unsigned threads);
+
+    const record& at(size_t i) const {
+        assert(i < size_);
+        auto it = std::upper_bound(chunks_.begin(), chunks_.end(), i, [](size_t i, const chunk& c) {
+            return i < c.first;
+        });
+        const chunk& c = *(it - 1);
+        return c.records[i - c.first];
+    }
+
+    record& at(size_t i) {
+        return const_cast<record&>(static_cast<const document_batch*>(this)->at(i));
+    }
+};
+
+class ondemand_document;
+
+/*
+ * A value in an ondemand_document, held as its place in the structural index. Nothing is parsed
+ * until it is asked for: lookups walk the index forward from the value and step over siblings by
+ * counting brackets without decoding them, and scalars are decoded by json::parse_value on get().
+ * Only the parts of the document that are read are validated.
+ */
+class ondemand_value {
+public:
+    // The member named key of an object, or a value carrying an error
+    ondemand_value operator[](const char* key) const {
+        return member(key, std::strlen(key));
+    }
+
+    ondemand_value operator[](const std::string& key) const {
+        return member(key.data(), key.size());
+    }
+
+    // The i-th element of an array, or a value carrying an error
+    ondemand_value operator[](int i) const;
+
+    // Why the value couldn't be found, or nullptr
+    const char* error() const {
+        return error_;
+    }
+
+    bool is_object() const { return first() == '{'; }
+    bool is_array() const { return first() == '['; }
+    bool is_string() const { return first() == '"'; }
+    bool is_number() const { return first() == '-' || (first() >= '0' && first() <= '9'); }
+    bool is_boolean() const { return first() == 't' || first() == 'f'; }
+    bool is_null() const { return first() == 'n'; }
+
+    // Number of elements or members, counted by walking them
+    size_t size() const;
+
+    // Decodes a scalar the same way json::get does. Strings are valid as long as the document
+    template <typename T>
+    result<T, const char*> get() const;
+
+    // Parses the value into a json document of its own, with the flags the ondemand_document was given
+    result<json, const char*> parse() const;
+
+    // Walks the elements of an array or the members of an object. Stops early at malformed input
+    class iterator {
+    public:
+        ondemand_value operator*() const;
+
+        // The name of the current member of an object
+        result<string_t, const char*> key() const;
+
+        iterator& operator++();
+
+        bool operator==(const iterator& other) const { return i_ == other.i_; }
+        bool operator!=(const iterator& other) const { return i_ != other.i_; }
+
+    private:
+        friend class ondemand_value;
+        iterator(const ondemand_document* doc, size_t i, bool in_object) : doc_(doc), i_(i), in_object_(in_object) {}
+
+        const ondemand_document* doc_;
+        // Index of the current element, or of the key of the current member
+        size_t i_;
+        bool in_object_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+
+private:
+    friend class ondemand_document;
+    friend class json;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    ondemand_value(const ondemand_document* doc, size_t i) : doc_(doc), i_(i) {}
+    ondemand_value(const ondemand_document* doc, const char* what) : doc_(doc), i_(npos), error_(what) {}
+
+    const ondemand_document* doc_;
+    size_t i_;
+    const char* error_ = nullptr;
+
+    char first() const;
+    ondemand_value member(const char* key, size_t size) const;
+};
+
+/*
+ * A document that is only indexed up front and parsed as it is read, for pulling a few fields
+ * out of a large message without building all of it.
+ *
+ *     fe::ondemand_document doc(buf, len);
+ *     auto id = doc["user"]["id"].get<int64_t>();
+ *
+ * The buffer must outlive the document and every value and string read from it.
+ */
+class ondemand_document {
+public:
+    ondemand_document(const char* buf, size_t len, parse_flags flags = parse_flags::none)
+        : buf_(buf), len_(len), flags_(flags | parse_flags::insitu), parse_flags_(flags) {
+        if (!json::find_structurals(buf, len, index_)) {
+            error_ = "Document too large";
+        } else if (index_.size == 0) {
+            error_ = "Unexpected end of string while parsing value";
+        }
+    }
+
+    explicit ondemand_document(const std::string& s, parse_flags flags = parse_flags::none)
+        : ondemand_document(s.data(), s.size(), flags) {}
+    ondemand_document(std::string&&, parse_flags = parse_flags::none) = delete;
+
+    ondemand_document(const ondemand_document&) = delete;
+    ondemand_document& operator=(const ondemand_document&) = delete;
+
+    ondemand_value root() const {
+        if (error_) {
+            return ondemand_value(this, error_);
+        }
+        return ondemand_value(this, size_t(0));
+    }
+
+    ondemand_value operator[](const char* key) const {
+        return root()[key];
+    }
+
+    ondemand_value operator[](const std::string& key) const {
+        return root()[key];
+    }
+
+    ondemand_value operator[](int i) const {
+        return root()[i];
+    }
+
+private:
+    friend class ondemand_value;
+    friend class json;
+
+    const char* buf_;
+    size_t len_;
+    // Strings are read in place while navigating
+    parse_flags flags_;
+    // As given, for the documents built by ondemand_value::parse()
+    parse_flags parse_flags_;
+    structural_index index_;
+    const char* error_ = nullptr;
+    // Escaped strings decoded by get()
+    mutable arena_allocator scratch_;
+
+    // The character at the i-th structural, or '\0' past the end
+    char at(size_t i) const {
+        return i < index_.size ? buf_[index_.positions[i]] : '\0';
+    }
+
+    // The index just past the value at i
+    size_t skip(size_t i) const {
+        if (at(i) != '{' && at(i) != '[') {
+            return i + 1;
+        }
+        size_t depth = 0;
+        do {
+            char c = at(i++);
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                depth--;
+            } else if (c == '\0') {
+                break;
+            }
+        } while (depth);
+        return i;
+    }
+
+    // The index of the next element or member after the one starting at i, or npos after the last.
+    // Members start at their key
+    size_t next(size_t i, bool in_object) const {
+        size_t end = skip(in_object ? i + 2 : i);
+        return at(end) == ',' ? end + 1 : ondemand_value::npos;
+    }
+
+    // The index of the first element or member of the array or object at i, or npos if it is empty
+    size_t first_child(size_t i) const {
+        char close = at(i) == '{' ? '}' : ']';
+        return at(i + 1) == close || at(i + 1) == '\0' ? ondemand_value::npos : i + 1;
+    }
+
+    result<string_t, const char*> decode_string(size_t i) const {
+        const char* c = buf_ + index_.positions[i];
+        auto ps = json::parse_string(&c, buf_ + len_, &scratch_, flags_);
+        if (!ps) {
+            return error<const char*>(ps.error());
+        }
+        return ps.value();
+    }
+
+    // Whether the key at i is the given one. Compares the raw bytes unless either has escapes.
+    // plain is false if key has a backslash, which could match the raw bytes of an escape
+    bool key_equals(size_t i, const char* key, size_t size, bool plain) const {
+        const char* raw = buf_ + index_.positions[i] + 1;
+        const char* raw_end = i + 1 < index_.size ? buf_ + index_.positions[i + 1] : buf_ + len_;
+        if (plain && static_cast<size_t>(raw_end - raw) > size && memcmp(raw, key, size) == 0 && raw[size] == '"') {
+            return true;
+        }
+        if (plain && !memchr(raw, '\\', static_cast<size_t>(raw_end - raw))) {
+            return false;
+        }
+        auto decoded = decode_string(i);
+        return decoded && decoded.value().size == size && memcmp(decoded.value().data, key, size) == 0;
+    }
+};
+
+inline char ondemand_value::first() const {
+    return error_ ? '\0' : doc_->at(i_);
+}
+
+inline ondemand_value ondemand_value::member(const char* key, size_t size) const {
+    if (error_) {
+        return *this;
+    }
+    if (!is_object()) {
+        return ondemand_value(doc_, "Not an object");
+    }
+    bool plain = !memchr(key, '\\', size);
+    for (size_t i = doc_->first_child(i_); i != npos; i = doc_->next(i, true)) {
+        if (doc_->at(i) != '"' || doc_->at(i + 1) != ':') {
+            return ondemand_value(doc_, "Expected start of String for Key");
+        }
+        if (doc_->key_equals(i, key, size, plain)) {
+            if (doc_->at(i + 2) == '\0') {
+                return ondemand_value(doc_, "Unexpected end of string while parsing value");
+            }
+            return ondemand_value(doc_, i + 2);
+        }
+    }
+    return ondemand_value(doc_, "No such key");
+}
+
+inline ondemand_value ondemand_value::operator[](int n) const {
+    if (error_) {
+        return *this;
+    }
+    if (!is_array()) {
+        return ondemand_value(doc_, "Not an array");
+    }
+    size_t i = doc_->first_child(i_);
+    for (; i != npos && n > 0; n--) {
+        i = doc_->next(i, false);
+    }
+    if (i == npos || n < 0) {
+        return ondemand_value(doc_, "Index out of range");
+    }
+    return ondemand_value(doc_, i);
+}
+
+inline size_t ondemand_value::size() const {
+    size_t n = 0;
+    for (iterator it = begin(); it != end(); ++it) {
+        n++;
+    }
+    return n;
+}
+
+template <typename T>
+inline result<T, const char*> ondemand_value::get() const {
+    if (error_) {
+        return fe::error<const char*>(error_);
+    }
+    if (i_ >= doc_->index_.size) {
+        return fe::error<const char*>("Unexpected end of string while parsing value");
+    }
+    json::structural_cursor s(doc_->buf_, doc_->len_, doc_->index_);
+    s.c = doc_->buf_ + doc_->index_.positions[i_];
+    auto value = json::parse_value(s, &doc_->scratch_, doc_->flags_);
+    if (!value) {
+        return fe::error<const char*>(value.error());
+    }
+    auto v = value.value().get<T>();
+    if (!v) {
+        return fe::error<const char*>("Invalid type");
+    }
+    return std::move(v).value();
+}
+
+inline result<json, const char*> ondemand_value::parse() const {
+    if (error_) {
+        return fe::error<const char*>(error_);
+    }
+    if (i_ >= doc_->index_.size) {
+        return fe::error<const char*>("Unexpected end of string while parsing value");
+    }
+    size_t end = doc_->skip(i_);
+    size_t begin_offset = doc_->index_.positions[i_];
+    size_t end_offset;
+    if (is_object() || is_array()) {
+        // skip() runs off the index when the container is never closed
+        char close = is_object() ? '}' : ']';
+        if (end > doc_->index_.size || doc_->at(end - 1) != close) {
+            return fe::error<const char*>("Unexpected end of string while parsing value");
+        }
+        end_offset = doc_->index_.positions[end - 1] + 1;
+    } else {
+        end_offset = end < doc_->index_.size ? doc_->index_.positions[end] : doc_->len_;
+    }
+    return json::parse(doc_->buf_ + begin_offset, end_offset - begin_offset, doc_->parse_flags_);
+}
+
+inline ondemand_value::iterator ondemand_value::begin() const {
+    if (!is_object() && !is_array()) {
+        return end();
+    }
+    return iterator(doc_, doc_->first_child(i_), is_object());
+}
+
+inline ondemand_value::iterator ondemand_value::end() const {
+    return iterator(doc_, npos, is_object());
+}
+
+inline ondemand_value ondemand_value::iterator::operator*() const {
+    if (in_object_ && (doc_->at(i_) != '"' || doc_->at(i_ + 1) != ':')) {
+        return ondemand_value(doc_, "Expected start of String for Key");
+    }
+    if (in_object_ && doc_->at(i_ + 2) == '\0') {
+        return ondemand_value(doc_, "Unexpected end of string while parsing value");
+    }
+    return ondemand_value(doc_, in_object_ ? i_ + 2 : i_);
+}
+
+inline result<string_t, const char*> ondemand_value::iterator::key() const {
+    if (!in_object_ || doc_->at(i_) != '"') {
+        return fe::error<const char*>("Expected start of String for Key");
+    }
+    return doc_->decode_string(i_);
+}
+
+inline ondemand_value::iterator& ondemand_value::iterator::operator++() {
+    i_ = doc_->next(i_, in_object_);
+    return *this;
+}
+
+// What an entry on the tape of a tape_document holds, stored in its top byte
+enum class tape_tag : uint8_t {
+    start_object = '{', // Payload: index past the matching end_object and number of members
+    end_object = '}', // Payload: index of the start_object
+    start_array = '[', // Payload: index past the matching end_array and number of elements
+    end_array = ']', // Payload: index of the start_array
+    string = '"', // Payload: offset of the string in the string buffer, which starts with its size
+    int_num = 'l', // The value is in the next entry
+    uint_num = 'u', // The value is in the next entry
+    float_num = 'd', // The value is in the next entry
+    true_value = 't',
+    false_value = 'f',
+    null = 'n',
+};
+
+class tape_document;
+
+/*
+ * A value in a tape_document: the index of its entry on the tape.
+ * Mirrors the read only parts of json. Looking up a missing key or index gives a value that is
+ * none of the is_* types and fails every get.
+ */
+class tape_value {
+public:
+    bool is_object() const { return tag() == tape_tag::start_object; }
+    bool is_array() const { return tag() == tape_tag::start_array; }
+    bool is_string() const { return tag() == tape_tag::string; }
+    bool is_number() const { return is_int() || is_uint() || is_double(); }
+    bool is_int() const { return tag() == tape_tag::int_num; }
+    bool is_uint() const { return tag() == tape_tag::uint_num; }
+    bool is_double() const { return tag() == tape_tag::float_num; }
+    bool is_boolean() const { return tag() == tape_tag::true_value || tag() == tape_tag::false_value; }
+    bool is_null() const { return tag() == tape_tag::null; }
+
+    // Number of elements, members or bytes in a string
+    size_t size() const;
+
+    template <typename T>
+    result<T, json_error> get() const;
+
+    tape_value operator[](const char* key) const {
+        return member(key, std::strlen(key));
+    }
+
+    tape_value operator[](const std::string& key) const {
+        return member(key.data(), key.size());
+    }
+
+    tape_value operator[](int i) const;
+
+    class iterator {
+    public:
+        tape_value operator*() const {
+            return value();
+        }
+
+        tape_value value() const {
+            return tape_value(doc_, in_object_ ? i_ + 1 : i_);
+        }
+
+        // The name of the current member of an object
+        const string_t key() const;
+
+        iterator& operator++();
+
+        bool operator==(const iterator& other) const { return i_ == other.i_; }
+        bool operator!=(const iterator& other) const { return i_ != other.i_; }
+
+    private:
+        friend class tape_value;
+        iterator(const tape_document* doc, size_t i, bool in_object) : doc_(doc), i_(i), in_object_(in_object) {}
+
+        const tape_document* doc_;
+        // Index of the current element, or of the key of the current member
+        size_t i_;
+        bool in_object_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+
+private:
+    friend class tape_document;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    tape_value(const tape_document* doc, size_t i) : doc_(doc), i_(i) {}
+
+    const tape_document* doc_;
+    size_t i_;
+
+    // A tag no entry has for values that weren't found
+    tape_tag tag() const;
+    tape_value member(const char* key, size_t size) const;
+};
+
+/*
+ * A read only document stored as one flat tape of 64-bit entries plus a buffer of strings, both in
+ * a single allocation. Objects and arrays record where they end, so they are skipped in O(1), and
+ * traversal walks memory in order instead of chasing pointers between nodes.
+ *
+ *     auto doc = fe::tape_document::parse(buf, len);
+ *     auto id = doc.value()["user"]["id"].get<int64_t>();
+ */
+class tape_document {
+public:
+    // Strings are copied to the document, so buf may be released once this returns
+    static result<tape_document, const char*> parse(const char* buf, size_t len, parse_flags flags = parse_flags::none);
+
+    static result<tape_document, const char*> parse(const std::string& s, parse_flags flags = parse_flags::none) {
+        return parse(s.data(), s.size(), flags);
+    }
+
+    tape_document(tape_document&& other) : tape_(other.tape_), strings_(other.strings_) {
+        other.tape_ = nullptr;
+        other.strings_ = nullptr;
+    }
+
+    tape_document& operator=(tape_document&& other) {
+        std::swap(tape_, other.tape_);
+        std::swap(strings_, other.strings_);
+        return *this;
+    }
+
+    tape_document(const tape_document&) = delete;
+    tape_document& operator=(const tape_document&) = delete;
+
+    ~tape_document() {
+        free(tape_);
+    }
+
+    tape_value root() const {
+        return tape_value(this, 0);
+    }
+
+    tape_value operator[](const char* key) const {
+        return root()[key];
+    }
+
+    tape_value operator[](const std::string& key) const {
+        return root()[key];
+    }
+
+    tape_value operator[](int i) const {
+        return root()[i];
+    }
+
+private:
+    friend class tape_value;
+    struct builder;
+
+    static constexpr uint64_t payload_mask = (uint64_t(1) << 56) - 1;
+    // Container entries keep the index past their end in the low bits and their size above it
+    static constexpr int end_bits = 40;
+    static constexpr uint64_t end_mask = (uint64_t(1) << end_bits) - 1;
+    static constexpr uint64_t max_count = payload_mask >> end_bits;
+
+    uint64_t* tape_ = nullptr;
+    // Each string is its size as a uint32_t followed by its bytes
+    char* strings_ = nullptr;
+
+    tape_document() = default;
+
+    tape_tag tag(size_t i) const {
+        return static_cast<tape_tag>(tape_[i] >> 56);
+    }
+
+    uint64_t payload(size_t i) const {
+        return tape_[i] & payload_mask;
+    }
+
+    // The index past the value at i
+    size_t skip(size_t i) const {
+        switch (tag(i)) {
+            case tape_tag::start_object:
+            case tape_tag::start_array:
+                return payload(i) & end_mask;
+            case tape_tag::int_num:
+            case tape_tag::uint_num:
+            case tape_tag::float_num:
+                return i + 2;
+            default:
+                return i + 1;
+        }
+    }
+
+    string_t string_at(size_t i) const {
+        char* s = strings_ + payload(i);
+        uint32_t size;
+        memcpy(&size, s, sizeof(size));
+        return string_t{s + sizeof(size), size};
+    }
+};
+
+// Appends parse_sax events to the tape
+struct tape_document::builder : sax_handler {
+    uint64_t* tape;
+    size_t size = 0;
+    char* strings;
+    size_t strings_size = 0;
+    // Open containers and the number of values in each so far
+    std::vector<std::pair<size_t, uint64_t>> open;
+
+    void append(tape_tag tag, uint64_t payload = 0) {
+        tape[size++] = (static_cast<uint64_t>(tag) << 56) | payload;
+    }
+
+    // Counts a value towards the size of its container. Keys aren't counted
+    void count() {
+        if (!open.empty()) {
+            open.back().second++;
+        }
+    }
+
+    void append_value(tape_tag tag, uint64_t payload = 0) {
+        count();
+        append(tag, payload);
+    }
+
+    void append_string(const string_t& s) {
+        append(tape_tag::string, strings_size);
+        uint32_t n = static_cast<uint32_t>(s.size);
+        memcpy(strings + strings_size, &n, sizeof(n));
+        memcpy(strings + strings_size + sizeof(n), s.data, s.size);
+        strings_size += sizeof(n) + s.size;
+    }
+
+    bool on_null() { append_value(tape_tag::null); return true; }
+    bool on_bool(bool b) { append_value(b ? tape_tag::true_value : tape_tag::false_value); return true; }
+
+    bool on_int(int64_t i) {
+        append_value(tape_tag::int_num);
+        tape[size++] = static_cast<uint64_t>(i);
+        return true;
+    }
+
+    bool on_uint(uint64_t u) {
+        append_value(tape_tag::uint_num);
+        tape[size++] = u;
+        return true;
+    }
+
+    bool on_double(double d) {
+        append_value(tape_tag::float_num);
+        memcpy(&tape[size++], &d, sizeof(d));
+        return true;
+    }
+
+    bool on_string(const string_t& s) {
+        count();
+        append_string(s);
+        return true;
+    }
+
+    bool on_key(const string_t& s) {
+        append_string(s);
+        return true;
+    }
+
+    bool on_start_object() { return start(tape_tag::start_object); }
+    bool on_end_object() { return end(tape_tag::end_object); }
+    bool on_start_array() { return start(tape_tag::start_array); }
+    bool on_end_array() { return end(tape_tag::end_array); }
+
+    bool start(tape_tag tag) {
+        append_value(tag);
+        open.emplace_back(size - 1, 0);
+        return true;
+    }
+
+    bool end(tape_tag tag) {
+        size_t start = open.back().first;
+        uint64_t count = open.back().second < max_count ? open.back().second : max_count;
+        open.pop_back();
+        append(tag, start);
+        tape[start] |= (count << end_bits) | size;
+        return true;
+    }
+};
+
+inline result<tape_document, const char*> tape_document::parse(const char* buf, size_t len, parse_flags flags) {
+    structural_index index;
+    if (!json::find_structurals(buf, len, index)) {
+        return error<const char*>("Document too large");
+    }
+
+    // Every value takes one entry, or two for numbers. Every string's size prefix is at most two
+    // bytes more than its quotes, so the strings fit in the input plus that
+    size_t entries = 0;
+    size_t strings = 0;
+    for (size_t i = 0; i < index.size; i++) {
+        switch (buf[index.positions[i]]) {
+            case ',':
+            case ':':
+                break;
+            case '"':
+                entries++;
+                strings++;
+                break;
+            case '-':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9':
+                entries += 2;
+                break;
+            default:
+                entries++;
+                break;
+        }
+    }
+
+    tape_document doc;
+    size_t tape_bytes = entries * sizeof(uint64_t);
+    doc.tape_ = static_cast<uint64_t*>(malloc(tape_bytes + len + 2 * strings));
+    doc.strings_ = reinterpret_cast<char*>(doc.tape_) + tape_bytes;
+
+    builder b;
+    b.tape = doc.tape_;
+    b.strings = doc.strings_;
+    json::structural_cursor s(buf, len, index);
+    auto parsed = json::parse_sax(s, b, flags);
+    if (!parsed) {
+        return error<const char*>(parsed.error());
+    }
+    assert(b.size <= entries);
+    return doc;
+}
+
+inline tape_tag tape_value::tag() const {
+    return i_ == npos ? static_cast<tape_tag>(0) : doc_->tag(i_);
+}
+
+inline size_t tape_value::size() const {
+    if (is_string()) {
+        return doc_->string_at(i_).size;
+    }
+    if (!is_object() && !is_array()) {
+        return 0;
+    }
+    uint64_t count = doc_->payload(i_) >> tape_document::end_bits;
+    if (count < tape_document::max_count) {
+        return count;
+    }
+    size_t n = 0;
+    for (iterator it = begin(); it != end(); ++it) {
+        n++;
+    }
+    return n;
+}
+
+template <typename T>
+inline result<T, json_error> tape_value::get() const {
+    uint64_t bits = 0;
+    if (is_number()) {
+        bits = doc_->tape_[i_ + 1];
+    }
+    switch (tag()) {
+        case tape_tag::string:
+            return json(doc_->string_at(i_)).get<T>();
+        case tape_tag::int_num:
+            return json(static_cast<int64_t>(bits)).get<T>();
+        case tape_tag::uint_num:
+            return json(bits).get<T>();
+        case tape_tag::float_num: {
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return json(d).get<T>();
+        }
+        case tape_tag::true_value:
+            return json(true).get<T>();
+        case tape_tag::false_value:
+            return json(false).get<T>();
+        case tape_tag::null:
+            return json().get<T>();
+        default:
+            return error<json_error>(json_error::invalid_type);
+    }
+}
+
+inline tape_value tape_value::member(const char* key, size_t size) const {
+    if (is_object()) {
+        for (iterator it = begin(); it != end(); ++it) {
+            string_t k = it.key();
+            if (k.size == size && memcmp(k.data, key, size) == 0) {
+                return it.value();
+            }
+        }
+    }
+    return tape_value(doc_, npos);
+}
+
+inline tape_value tape_value::operator[](int n) const {
+    if (is_array() && n >= 0) {
+        for (iterator it = begin(); it != end(); ++it) {
+            if (n-- == 0) {
+                return *it;
+            }
+        }
+    }
+    return tape_value(doc_, npos);
+}
+
+inline tape_value::iterator tape_value::begin() const {
+    if (!is_object() && !is_array()) {
+        return end();
+    }
+    return iterator(doc_, i_ + 1, is_object());
+}
+
+inline tape_value::iterator tape_value::end() const {
+    if (!is_object() && !is_array()) {
+        return iterator(doc_, npos, false);
+    }
+    // The end_object or end_array entry
+    return iterator(doc_, doc_->skip(i_) - 1, is_object());
+}
+
+inline const string_t tape_value::iterator::key() const {
+    assert(in_object_);
+    return doc_->string_at(i_);
+}
+
+inline tape_value::iterator& tape_value::iterator::operator++() {
+    i_ = doc_->skip(in_object_ ? i_ + 1 : i_);
+    return *this;
+}
+
+inline const char* json::build_path_tree(const std::vector<std::string>& paths, std::vector<path_node>& nodes) {
+    for (const std::string& path : paths) {
+        if (!path.empty() && path[0] != '/') {
+            return "JSON Pointer must start with '/'";
+        }
+        size_t node = 0;
+        size_t start = 1;
+        while (start <= path.size() && !nodes[node].whole) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+            // ~1 is '/' and ~0 is '~'
+            std::string name;
+            for (size_t i = start; i < end; i++) {
+                if (path[i] == '~' && i + 1 < end && (path[i + 1] == '0' || path[i + 1] == '1')) {
+                    name += path[++i] == '0' ? '~' : '/';
+                } else {
+                    name += path[i];
+                }
+            }
+            size_t child = 0;
+            for (size_t c : nodes[node].children) {
+                if (nodes[c].name == name) {
+                    child = c;
+                    break;
+                }
+            }
+            if (!child) {
+                child = nodes.size();
+                nodes[node].children.push_back(child);
+                nodes.emplace_back();
+                nodes.back().name = std::move(name);
+            }
+            node = child;
+            start = end + 1;
+        }
+        nodes[node].whole = true;
+    }
+    return nullptr;
+}
+
+inline result<json, const char*> json::parse_paths(const char* buf, size_t len, const std::vector<std::string>& paths,
+                                                   parse_flags flags) {
+    std::vector<path_node> nodes(1);
+    if (const char* what = build_path_tree(paths, nodes)) {
+        return error<const char*>(what);
+    }
+
+    ondemand_document doc(buf, len, flags);
+    if (doc.error_) {
+        return error<const char*>(doc.error_);
+    }
+    json root = json::doc();
+    if (const char* what = select_paths(doc, nodes, 0, 0, root, flags)) {
+        return error<const char*>(what);
+    }
+    if (!nodes[0].whole && !selected_anything(root)) {
+        return json::doc();
+    }
+    return root;
+}
+
+inline const char* json::select_paths(const ondemand_document& doc, const std::vector<path_node>& nodes, size_t node,
+                                      size_t i, json& out, parse_flags flags) {
+    const path_node& n = nodes[node];
+    if (n.whole) {
+        // Parse the value at i into the document out is part of
+        structural_cursor s(doc.buf_, doc.len_, doc.index_);
+        s.next = doc.index_.positions + i;
+        dom_builder builder(out.arena());
+        auto parsed = parse_document(s, builder, flags);
+        if (!parsed) {
+            return parsed.error();
+        }
+        out = std::move(builder.root);
+        return nullptr;
+    }
+
+    if (doc.at(i) == '{') {
+        for (size_t member = doc.first_child(i); member != ondemand_value::npos; member = doc.next(member, true)) {
+            if (doc.at(member) != '"' || doc.at(member + 1) != ':') {
+                return "Expected start of String for Key";
+            }
+            for (size_t child : n.children) {
+                const std::string& name = nodes[child].name;
+                bool plain = name.find('\\') == std::string::npos;
+                if (doc.key_equals(member, name.data(), name.size(), plain)) {
+                    size_t size = out.is_object() ? out.size() : 0;
+                    json& selected = out[name];
+                    if (const char* what = select_paths(doc, nodes, child, member + 2, selected, flags)) {
+                        return what;
+                    }
+                    if (!nodes[child].whole && out.size() > size && !selected_anything(selected)) {
+                        out.value.object->pop_back();
+                    }
+                }
+            }
+        }
+    } else if (doc.at(i) == '[') {
+        size_t index = 0;
+        for (size_t element = doc.first_child(i); element != ondemand_value::npos; element = doc.next(element, false)) {
+            std::string name = std::to_string(index++);
+            for (size_t child : n.children) {
+                if (nodes[child].name == name) {
+                    if (out.is_null()) {
+                        assert(out.arena());
+                        out.type = value_t::array;
+                        out.value.array = alloc_array(out.arena());
+                    }
+                    out.value.array->emplace_back(out.arena());
+                    if (const char* what = select_paths(doc, nodes, child, element, out.value.array->back(), flags)) {
+                        return what;
+                    }
+                    if (!nodes[child].whole && !selected_anything(out.value.array->back())) {
+                        out.value.array->pop_back();
+                    }
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+struct json::path_watch {
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    const std::vector<path_node>& nodes;
+    // Paths whose value is complete, so duplicate keys don't count twice
+    std::vector<bool> seen;
+    size_t remaining = 0;
+    // The node of every open object and array, innermost last, or npos off every path
+    std::vector<size_t> open;
+
+    explicit path_watch(const std::vector<path_node>& nodes) : nodes(nodes), seen(nodes.size()) {
+        for (const path_node& node : nodes) {
+            remaining += node.whole ? 1 : 0;
+        }
+    }
+
+    bool root(const json& value) {
+        return add(0, value);
+    }
+
+    bool member(const string_t& key, const json& value) {
+        return add(child(open.back(), key.data, key.size), value);
+    }
+
+    bool element(size_t index, const json& value) {
+        size_t parent = open.back();
+        if (parent == npos || nodes[parent].children.empty()) {
+            return add(npos, value);
+        }
+        std::string name = std::to_string(index);
+        return add(child(parent, name.data(), name.size()), value);
+    }
+
+    bool end() {
+        size_t node = open.back();
+        open.pop_back();
+        return complete(node);
+    }
+
+private:
+    size_t child(size_t parent, const char* name, size_t size) const {
+        if (parent == npos) {
+            return npos;
+        }
+        for (size_t c : nodes[parent].children) {
+            const std::string& n = nodes[c].name;
+            if (n.size() == size && memcmp(n.data(), name, size) == 0) {
+                return c;
+            }
+        }
+        return npos;
+    }
+
+    bool add(size_t node, const json& value) {
+        if (value.is_object() || value.is_array()) {
+            open.push_back(node);
+            return true;
+        }
+        return complete(node);
+    }
+
+    bool complete(size_t node) {
+        if (node == npos || !nodes[node].whole || seen[node]) {
+            return true;
+        }
+        seen[node] = true;
+        return --remaining != 0;
+    }
+};
+
+inline result<json, const char*> json::parse_until(const char* buf, size_t len, const std::vector<std::string>& paths,
+                                                   parse_flags flags) {
+    std::vector<path_node> nodes(1);
+    if (const char* what = build_path_tree(paths, nodes)) {
+        return error<const char*>(what);
+    }
+
+    // Stage 1 only indexes a window at the start of the input. Indexing is done front to back,
+    // so the window's index matches the start of the whole one. Parsing that runs off the end of
+    // it starts over with a window four times as large, which keeps the work in proportion to
+    // how far parsing gets.
+    structural_index index;
+    size_t window = len < 64 * 1024 ? len : 64 * 1024;
+    for (;;) {
+        if (!find_structurals(buf, window, index)) {
+            return error<const char*>("Document too large");
+        }
+        structural_cursor s(buf, len, index);
+        dom_builder builder;
+        path_watch watch(nodes);
+
+        auto parsed = parse_document(s, builder, flags, watch);
+        if (parsed && !parsed.value()) {
+            while (!builder.done()) {
+                builder.end();
+            }
+            return std::move(builder.root);
+        }
+        if (window < len && s.at_end()) {
+            window = len / 4 < window ? len : window * 4;
+            continue;
+        }
+        if (!parsed) {
+            return error<const char*>(parsed.error());
+        }
+        if (!s.at_end()) {
+            return error<const char*>("Unexpected character");
+        }
+        return std::move(builder.root);
+    }
+}
+
+} // namespace fe
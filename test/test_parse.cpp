@@ -3,6 +3,9 @@
 
 #include <iron/json.h>
 
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <sstream>
 #include <iostream>
 
@@ -298,6 +301,24 @@ TEST("parse UTF-8") {
         auto j = json::parse("\"\xa0\xa1\"");
         CHECK(!j);
     }
+    // Overlong encodings, surrogates, code points past U+10FFFF, and truncated sequences
+    CHECK(!json::parse("\"\xc0\xaf\""));
+    CHECK(!json::parse("\"\xe0\x80\xaf\""));
+    CHECK(!json::parse("\"\xf0\x80\x80\xaf\""));
+    CHECK(!json::parse("\"\xed\xa0\x80\""));
+    CHECK(!json::parse("\"\xf4\x90\x80\x80\""));
+    CHECK(!json::parse("\"\xe2\x82\""));
+    CHECK(json::parse("\"\xf4\x8f\xbf\xbf\""));
+    {
+        // Multi-byte sequences straddling vector boundaries
+        std::string s;
+        for (int i = 0; i < 40; i++) s += u8"a€😹";
+        auto j = json::parse("\"" + s + "\"");
+        REQUIRE(j);
+        CHECK(j.value().get<std::string>().value() == s);
+        CHECK(!json::parse("\"" + s + "\xe2\x82\""));
+        CHECK(!json::parse("\"" + s + "\xe2\x82" + s + "\""));
+    }
 }
 
 TEST("parse and dump") {
@@ -320,3 +341,945 @@ R"({
     auto j = json::parse(data).value();
     CHECK(j.dump() == R"({"Image":{"Width":800,"Height":600,"Title":"View from 15th Floor","Thumbnail":{"Url":"http://www.example.com/image/481989943","Height":125,"Width":100},"Animated":false,"IDs":[116,943,234,38793]}})");
 }
+
+TEST("json::find_structurals") {
+    auto structurals_are = [](const std::string& s, const std::vector<uint32_t>& expected) {
+        fe::structural_index index;
+        REQUIRE(json::find_structurals(s.data(), s.size(), index));
+        return std::vector<uint32_t>(index.positions, index.positions + index.size) == expected;
+    };
+    CHECK(structurals_are("", {}));
+    CHECK(structurals_are(R"({"a": [1, true]})", {0, 1, 4, 6, 7, 8, 10, 14, 15}));
+    // Structural characters inside strings are ignored, including across 64 byte blocks
+    std::string s = "[\"" + std::string(70, '{') + "\\\"\\\\\", 1]";
+    CHECK(structurals_are(s, {0, 1, 77, 79, 80}));
+    // Only the first byte of a run of non-structural characters is recorded
+    CHECK(structurals_are("[12 3x]", {0, 1, 4, 6}));
+}
+
+TEST("json::parse values must be separated") {
+    CHECK(!json::parse("[1,]"));
+    CHECK(!json::parse(R"({"a": 1,})"));
+    CHECK(!json::parse("[1 2]"));
+    CHECK(!json::parse("[1x]"));
+    CHECK(!json::parse("[fanse]"));
+    CHECK(!json::parse("[true\"a\"]"));
+    CHECK(!json::parse(R"(["a""b"])"));
+    CHECK(!json::parse(R"({"a" "b"})"));
+    CHECK(json::parse("[1,[2,{\"3\":4}],\n\t5]"));
+}
+
+TEST("json::parse string blocks") {
+    // Runs of backslashes that straddle 64 byte blocks
+    for (size_t pad = 55; pad < 70; pad++) {
+        std::string body = std::string(pad, 'x') + "\\\\\\\"" + std::string(pad, 'y') + "\\\\";
+        auto j = json::parse("[\"" + body + "\", 1]");
+        REQUIRE(j);
+        CHECK(j.value()[0].get<std::string>().value() == std::string(pad, 'x') + "\\\"" + std::string(pad, 'y') + "\\");
+        CHECK(j.value()[1].get<int32_t>().value() == 1);
+    }
+    CHECK(!json::parse("\"" + std::string(100, 'a') + "\\\""));
+    // Control characters must be escaped
+    CHECK(!json::parse("\"a\tb\""));
+    CHECK(!json::parse("\"a\nb\""));
+    CHECK(!json::parse(std::string("\"a\0b\"", 5)));
+    CHECK(!json::parse("\"" + std::string(100, 'a') + "\x1f\""));
+    CHECK(json::parse("\"\x7f\""));
+}
+
+TEST("json::parse real numbers") {
+    auto parses_to = [](const std::string& s, double expected) {
+        auto j = json::parse(s);
+        return j && j.value().is_double() && j.value().get<double>().value() == expected;
+    };
+    CHECK(parses_to("1.05", 1.05));
+    CHECK(parses_to("0.05", 0.05));
+    CHECK(parses_to("-12.000305", -12.000305));
+    CHECK(parses_to("0e5", 0.0));
+    CHECK(parses_to("0.1", 0.1));
+    CHECK(parses_to("3.141592653589793", 3.141592653589793));
+    CHECK(parses_to("-65.613616999999977", -65.613616999999977));
+    CHECK(parses_to("1e23", 1e23));
+    CHECK(parses_to("1.7976931348623157e308", 1.7976931348623157e308));
+    CHECK(parses_to("2.2250738585072011e-308", 2.2250738585072011e-308));
+    CHECK(parses_to("4.9e-324", 4.9e-324));
+    CHECK(parses_to("1e-400", 0.0));
+    CHECK(parses_to("1e400", HUGE_VAL));
+    CHECK(parses_to("-1e400", -HUGE_VAL));
+    CHECK(parses_to("1e-99999999999999999999", 0.0));
+    // Halfway between two doubles rounds to even
+    CHECK(parses_to("9007199254740993.0", 9007199254740992.0));
+    CHECK(parses_to("9007199254740995.0", 9007199254740996.0));
+    // More than 19 significant digits
+    CHECK(parses_to("0.1000000000000000055511151231257827", 0.1));
+    CHECK(parses_to("123456789012345678901234567890.5e-10", 123456789012345678901234567890.5e-10));
+    CHECK(parses_to("9007199254740993.00000000000000000001", 9007199254740994.0));
+    auto j = json::parse("-0.0");
+    REQUIRE(j);
+    CHECK(std::signbit(j.value().get<double>().value()));
+
+    CHECK(!json::parse("1."));
+    CHECK(!json::parse("[1.]"));
+    CHECK(!json::parse("1.e5"));
+    CHECK(!json::parse("1e+"));
+    CHECK(!json::parse("[1e-]"));
+    CHECK(!json::parse(".5"));
+}
+
+TEST("json::parse digit runs") {
+    auto j = json::parse("[12345678, 123456789012, -1234567890123456789, 1618033988.7498948482045868]");
+    REQUIRE(j);
+    CHECK(j.value()[0].get<uint64_t>().value() == 12345678u);
+    CHECK(j.value()[1].get<uint64_t>().value() == 123456789012ull);
+    CHECK(j.value()[2].get<int64_t>().value() == -1234567890123456789ll);
+    CHECK(j.value()[3].get<double>().value() == 1618033988.7498948482045868);
+
+    j = json::parse("[18446744073709551615, -9223372036854775808, 0.00000000012345678]");
+    REQUIRE(j);
+    CHECK(j.value()[0].get<uint64_t>().value() == 18446744073709551615ull);
+    CHECK(j.value()[1].get<int64_t>().value() == INT64_MIN);
+    CHECK(j.value()[2].get<double>().value() == 0.00000000012345678);
+
+    CHECK(!json::parse("18446744073709551616"));
+    CHECK(!json::parse("28446744073709551616"));
+    CHECK(!json::parse("-9223372036854775809"));
+    CHECK(!json::parse("-19223372036854775808"));
+    CHECK(!json::parse("[12345678x]"));
+    CHECK(!json::parse("[0123456789]"));
+}
+
+TEST("json::parse pointer and length") {
+    // Only the first len bytes are parsed and no terminator is needed
+    const char frame[] = {'[', '1', ',', '"', 'a', '"', ']', 'x', 'x'};
+    auto j = json::parse(frame, 7);
+    REQUIRE(j);
+    CHECK(j.value()[0].get<int32_t>().value() == 1);
+    CHECK(j.value()[1].get<std::string>().value() == "a");
+    CHECK(!json::parse(frame, 9));
+    CHECK(!json::parse(frame, 6));
+    CHECK(json::parse("{\"a\": null}"));
+#if __cplusplus >= 201703L
+    std::string_view view(frame, 7);
+    CHECK(json::parse(view));
+#endif
+
+    // Halfway between two doubles, so it needs strtod, and the digits after len would round it up
+    std::string number = "9007199254740993.00000000000000000000199999";
+    auto d = json::parse(number.data(), number.size() - 6);
+    REQUIRE(d);
+    CHECK(d.value().get<double>().value() == 9007199254740992.0);
+    std::string in_array = "[-" + number + "]";
+    auto negative = json::parse(in_array);
+    REQUIRE(negative);
+    CHECK(negative.value()[0].get<double>().value() == -9007199254740994.0);
+}
+
+TEST("json::parse insitu") {
+    std::string input = R"({"name": "iron", "escaped": "a\nb", "list": ["x"]})";
+    auto j = json::parse(input, fe::parse_flags::insitu);
+    REQUIRE(j);
+    auto in_input = [&](const json& s) {
+        auto str = s.get<fe::string_t>().value();
+        return str.data >= &input.front() && str.data + str.size <= &input.back();
+    };
+    CHECK(in_input(j.value()["name"]));
+    CHECK(in_input(j.value()["list"][0]));
+    CHECK(!in_input(j.value()["escaped"]));
+    auto key = j.value().begin().key();
+    CHECK(key.data >= &input.front() && key.data < &input.back());
+    CHECK(j.value()["name"].get<std::string>().value() == "iron");
+    CHECK(j.value()["escaped"].get<std::string>().value() == "a\nb");
+
+    // Without the flag every string is copied
+    j = json::parse(input);
+    REQUIRE(j);
+    CHECK(!in_input(j.value()["name"]));
+}
+
+TEST("json::parse_inplace") {
+    std::string input = R"({"plain": "iron", "esc\"aped": "a\né😀b", "list": ["\\\\"]})";
+    std::vector<char> buf(input.begin(), input.end());
+    auto j = json::parse_inplace(buf.data(), buf.size());
+    REQUIRE(j);
+    auto in_buf = [&](const json& s) {
+        auto str = s.get<fe::string_t>().value();
+        return str.data >= buf.data() && str.data + str.size <= buf.data() + buf.size();
+    };
+    CHECK(in_buf(j.value()["plain"]));
+    CHECK(in_buf(j.value()["esc\"aped"]));
+    CHECK(in_buf(j.value()["list"][0]));
+    CHECK(j.value()["plain"].get<std::string>().value() == "iron");
+    CHECK(j.value()["esc\"aped"].get<std::string>().value() == u8"a\né\U0001F600b");
+    CHECK(j.value()["list"][0].get<std::string>().value() == "\\\\");
+
+    std::string scalar = R"("A\tB")";
+    auto s = json::parse_inplace(&scalar[0], scalar.size());
+    REQUIRE(s);
+    CHECK(s.value().get<std::string>().value() == "A\tB");
+}
+
+TEST("json::parse_file") {
+    std::ifstream f("data/demo.json");
+    std::stringstream ss;
+    ss << f.rdbuf();
+    auto expected = json::parse(ss.str());
+    REQUIRE(expected);
+
+    auto j = json::parse_file("data/demo.json");
+    REQUIRE(j);
+    CHECK(j.value().dump() == expected.value().dump());
+
+    // The mapping lives as long as the document
+    j = json::parse_file("data/demo.json", fe::parse_flags::insitu);
+    REQUIRE(j);
+    CHECK(j.value().dump() == expected.value().dump());
+    CHECK(j.value()["Image"]["Title"].get<std::string>().value() == "View from 15th Floor");
+
+    CHECK(!json::parse_file("data/does_not_exist.json"));
+
+    // A multiple of the page size, so nothing is mapped after the number the file ends with
+    std::string number = "9007199254740993.00000000000000000000000001";
+    std::string page_sized = std::string(16384 - number.size(), ' ') + number;
+    const char* path = "page_sized.json";
+    std::ofstream(path, std::ios::binary) << page_sized;
+    j = json::parse_file(path);
+    std::remove(path);
+    REQUIRE(j);
+    CHECK(j.value().get<double>().value() == 9007199254740994.0);
+}
+
+TEST("push_parser") {
+    const char* docs[] = {
+        R"({"a": [1, -2.5e3, true, false, null], "b\"c": {"d": "eé\\"}, "f": []})",
+        R"([{}, [], "", 18446744073709551615, -9223372036854775808, 0.1])",
+        R"( "just a string" )",
+        "12345",
+    };
+    for (const char* doc : docs) {
+        std::string s = doc;
+        auto expected = json::parse(s);
+        REQUIRE(expected);
+        // Split the document at every position, including inside tokens and escapes
+        for (size_t i = 0; i <= s.size(); i++) {
+            fe::push_parser p;
+            REQUIRE(p.feed(s.data(), i));
+            REQUIRE(p.feed(s.data() + i, s.size() - i));
+            auto j = p.finish();
+            REQUIRE(j);
+            CHECK(j.value().dump() == expected.value().dump());
+        }
+        // One byte at a time
+        fe::push_parser p;
+        for (char c : s) {
+            REQUIRE(p.feed(&c, 1));
+        }
+        auto j = p.finish();
+        REQUIRE(j);
+        CHECK(j.value().dump() == expected.value().dump());
+    }
+
+    fe::push_parser p;
+    auto r = p.feed("[1, 2");
+    REQUIRE(r);
+    CHECK(!r.value());
+    r = p.feed("]");
+    REQUIRE(r);
+    CHECK(r.value());
+    CHECK(p.finish().value().size() == 2u);
+
+    // The parser is reusable after finish()
+    CHECK(p.feed("{\"a\" 1}").error() == std::string("Expected ':'"));
+    CHECK(!p.feed("{}"));
+    CHECK(!p.finish());
+    CHECK(p.feed("{}").value());
+
+    p.reset();
+    CHECK(p.feed("[tr").value() == false);
+    CHECK(p.feed("ue]").value());
+    p.reset();
+    CHECK(p.feed("[tr").value() == false);
+    CHECK(!p.feed("x]"));
+    p.reset();
+    CHECK(p.feed("[1.").value() == false);
+    CHECK(!p.feed("]"));
+    p.reset();
+    CHECK(p.feed("[\"abc").value() == false);
+    CHECK(!p.finish());
+    CHECK(p.feed("[1] 2").error() == std::string("Unexpected character"));
+    p.reset();
+    CHECK(p.feed("[1,").value() == false);
+    CHECK(!p.finish());
+}
+
+TEST("document_stream") {
+    std::string input =
+        "{\"a\": 1}\n"
+        "[1, 2, 3]\n"
+        "{\"a\": 2\n"
+        "\"unterminated\n"
+        "\"str\" 4 true{\"b\":[null]}\n"
+        "\n"
+        "  {\"c\": \"x\"}";
+    const char* expected[] = {
+        R"({"a":1})",
+        "[1,2,3]",
+        nullptr,
+        nullptr,
+        R"("str")",
+        "4",
+        "true",
+        R"({"b":[null]})",
+        R"({"c":"x"})",
+    };
+    // Small batches make documents and errors straddle the indexed windows
+    for (size_t batch_size : {size_t(1), size_t(7), fe::document_stream::default_batch_size}) {
+        fe::document_stream stream(input.data(), input.size(), fe::parse_flags::none, batch_size);
+        size_t n = 0;
+        while (stream.next()) {
+            REQUIRE(n < sizeof(expected) / sizeof(expected[0]));
+            if (expected[n]) {
+                REQUIRE(!stream.error());
+                CHECK(stream.value().dump() == expected[n]);
+            } else {
+                CHECK(stream.error());
+            }
+            n++;
+        }
+        CHECK(n == sizeof(expected) / sizeof(expected[0]));
+    }
+
+    std::string pretty_input = "{\n  \"a\": [\n    1\n  ]\n}\n{\n}\n";
+    fe::document_stream pretty(pretty_input);
+    REQUIRE(pretty.next());
+    CHECK(pretty.offset() == 0u);
+    CHECK(pretty.value()["a"].size() == 1u);
+    REQUIRE(pretty.next());
+    CHECK(pretty.value().is_object());
+    CHECK(!pretty.next());
+
+    const char* blank = " \n\n ";
+    fe::document_stream empty(blank, strlen(blank));
+    CHECK(!empty.next());
+}
+
+TEST("document_batch") {
+    // Large enough to be split across threads
+    std::string input;
+    size_t lines = 0;
+    while (input.size() < 3 * fe::document_batch::min_chunk_size) {
+        if (lines % 1000 == 999) {
+            input += "{\"broken\": \n";
+        } else {
+            input += "{\"line\": " + std::to_string(lines) + ", \"tags\": [\"a\", \"b\"]}\n";
+        }
+        lines++;
+    }
+
+    fe::document_batch docs(input.data(), input.size(), fe::parse_flags::none, 4);
+    REQUIRE(docs.size() == lines);
+    fe::document_stream stream(input);
+    for (size_t i = 0; i < docs.size(); i++) {
+        REQUIRE(stream.next());
+        CHECK(docs.offset(i) == stream.offset());
+        if (i % 1000 == 999) {
+            CHECK(docs.error(i));
+        } else {
+            REQUIRE(!docs.error(i));
+            CHECK(docs[i]["line"].get<int64_t>().value() == static_cast<int64_t>(i));
+        }
+    }
+    CHECK(!stream.next());
+
+    fe::document_batch one("[1]\n2", 5);
+    REQUIRE(one.size() == 2u);
+    CHECK(one[1].get<int64_t>().value() == 2);
+
+    auto file = fe::document_batch::parse_file("data/demo.json", fe::parse_flags::insitu);
+    REQUIRE(file);
+    REQUIRE(file.value().size() == 1u);
+    CHECK(file.value()[0]["Image"]["Title"].get<std::string>().value() == "View from 15th Floor");
+    CHECK(!fe::document_batch::parse_file("data/does_not_exist.json"));
+}
+
+TEST("json::parse_parallel") {
+    // Elements with nested arrays and strings that look like element boundaries
+    std::string input = "[";
+    for (size_t i = 0; input.size() < 3 * (1 << 20); i++) {
+        if (i > 0) {
+            input += ",\n";
+        }
+        input += "{\"id\": " + std::to_string(i) + ", \"s\": \"}, {\\\"\\\\\", \"nested\": [[1, 2], {\"a\": [3]}], \"x\": 1.5}";
+    }
+    input += "]";
+
+    auto expected = json::parse(input);
+    REQUIRE(expected);
+    for (unsigned threads : {1u, 2u, 3u, 8u}) {
+        auto j = json::parse_parallel(input, fe::parse_flags::none, threads);
+        REQUIRE(j);
+        REQUIRE(j.value().size() == expected.value().size());
+        CHECK(j.value().dump() == expected.value().dump());
+    }
+    auto insitu = json::parse_parallel(input, fe::parse_flags::insitu, 4);
+    REQUIRE(insitu);
+    CHECK(insitu.value()[7]["s"].get<std::string>().value() == "}, {\"\\");
+
+    // Errors come from the serial parse
+    std::string broken = input;
+    broken[broken.size() / 2] = '#';
+    CHECK(json::parse_parallel(broken, fe::parse_flags::none, 4).error() == json::parse(broken).error());
+    CHECK(!json::parse_parallel(input + ",", fe::parse_flags::none, 4));
+    CHECK(!json::parse_parallel(input + "]", fe::parse_flags::none, 4));
+    CHECK(!json::parse_parallel(input.substr(0, input.size() - 1), fe::parse_flags::none, 4));
+
+    // Not an array
+    CHECK(json::parse_parallel("{\"a\": [1]}", fe::parse_flags::none, 4).value()["a"].size() == 1u);
+}
+
+namespace {
+// Writes events back out as compact JSON
+struct sax_writer : fe::sax_handler {
+    std::string out;
+    std::vector<bool> first{true};
+    size_t stop_after = static_cast<size_t>(-1);
+    size_t events = 0;
+    bool after_key = false;
+
+    bool emit(const std::string& s) {
+        if (!after_key && !first.back()) out += ",";
+        first.back() = false;
+        after_key = false;
+        out += s;
+        return ++events < stop_after;
+    }
+    bool on_null() { return emit("null"); }
+    bool on_bool(bool b) { return emit(b ? "true" : "false"); }
+    bool on_int(int64_t i) { return emit(std::to_string(i)); }
+    bool on_uint(uint64_t u) { return emit(std::to_string(u)); }
+    bool on_double(double d) { return emit(json(d).dump()); }
+    bool on_string(const fe::string_t& s) { return emit(json(std::string(s.data, s.size)).dump()); }
+    bool on_key(const fe::string_t& s) {
+        bool more = emit(json(std::string(s.data, s.size)).dump() + ":");
+        after_key = true;
+        return more;
+    }
+    bool on_start_object() { bool more = emit("{"); first.push_back(true); return more; }
+    bool on_end_object() { first.pop_back(); out += "}"; return ++events < stop_after; }
+    bool on_start_array() { bool more = emit("["); first.push_back(true); return more; }
+    bool on_end_array() { first.pop_back(); out += "]"; return ++events < stop_after; }
+};
+} // namespace
+
+TEST("json::parse_sax") {
+    const char* docs[] = {
+        R"({"a": [1, -2.5, true, false, null], "b\"c": {"d": "eé\\"}, "f": [], "g": {}})",
+        R"([{}, [[]], "", 18446744073709551615, -9223372036854775808])",
+        R"( "just a string" )",
+        "12345",
+    };
+    for (const char* doc : docs) {
+        sax_writer w;
+        auto r = json::parse_sax(doc, strlen(doc), w);
+        REQUIRE(r);
+        CHECK(r.value());
+        CHECK(w.out == json::parse(doc).value().dump());
+    }
+
+    std::ifstream f("data/github_events.json");
+    std::stringstream ss;
+    ss << f.rdbuf();
+    sax_writer events;
+    REQUIRE(json::parse_sax(ss.str(), events).value());
+    CHECK(events.out == json::parse(ss.str()).value().dump());
+
+    // Stopped by the handler
+    sax_writer stopper;
+    stopper.stop_after = 3;
+    auto stopped = json::parse_sax(std::string("[1, 2, 3, 4]"), stopper);
+    REQUIRE(stopped);
+    CHECK(!stopped.value());
+    CHECK(stopper.out == "[1,2");
+
+    // Same errors as json::parse
+    const char* bad[] = {"", "[1, 2", "{\"a\" 1}", "{\"a\": 1,}", "[1 2]", "{1: 2}", "[1] 2", "[tru]", "{\"a\": [}"};
+    for (const char* doc : bad) {
+        fe::sax_handler h;
+        auto r = json::parse_sax(doc, strlen(doc), h);
+        REQUIRE(!r);
+        CHECK(std::string(r.error()) == json::parse(doc).error());
+    }
+}
+
+TEST("ondemand_document") {
+    std::string input = R"({
+        "user": {"name": "iron", "id": 42, "tags": ["a", "b\n", {"deep": [1, 2]}]},
+        "skipped": {"nested": [[[{"x": "]}"}]]], "more": 1.5},
+        "escaped": -7,
+        "big": 18446744073709551615,
+        "flag": true,
+        "none": null
+    })";
+    fe::ondemand_document doc(input);
+    CHECK(doc["user"]["id"].get<int64_t>().value() == 42);
+    CHECK(doc["user"]["name"].get<std::string>().value() == "iron");
+    CHECK(doc["user"]["tags"][1].get<std::string>().value() == "b\n");
+    CHECK(doc["user"]["tags"][2]["deep"][1].get<int64_t>().value() == 2);
+    CHECK(doc["user"]["tags"].size() == 3u);
+    CHECK(doc["escaped"].get<int64_t>().value() == -7);
+    CHECK(doc["big"].get<uint64_t>().value() == 18446744073709551615ull);
+    CHECK(doc["flag"].get<bool>().value());
+    CHECK(doc["none"].is_null());
+    CHECK(doc["skipped"]["more"].get<double>().value() == 1.5);
+    CHECK(doc["skipped"]["nested"][0][0][0]["x"].get<std::string>().value() == "]}");
+
+    CHECK(std::string(doc["missing"]["id"].error()) == "No such key");
+    CHECK(std::string(doc["user"][0].error()) == "Not an array");
+    CHECK(std::string(doc["user"]["tags"][3].error()) == "Index out of range");
+    CHECK(std::string(doc["user"]["id"].get<std::string>().error()) == "Invalid type");
+
+    std::string keys;
+    for (auto it = doc["user"].begin(); it != doc["user"].end(); ++it) {
+        keys += std::string(it.key().value().data, it.key().value().size) + " ";
+    }
+    CHECK(keys == "name id tags ");
+    int64_t sum = 0;
+    for (auto it = doc["user"]["tags"][2]["deep"].begin(); it != doc["user"]["tags"][2]["deep"].end(); ++it) {
+        sum += (*it).get<int64_t>().value();
+    }
+    CHECK(sum == 3);
+
+    auto user = doc["user"].parse();
+    REQUIRE(user);
+    CHECK(user.value().dump() == json::parse(input).value()["user"].dump());
+    CHECK(doc["big"].parse().value().get<uint64_t>().value() == 18446744073709551615ull);
+
+    // Only what is read is validated
+    std::string partly_broken = R"({"ok": 1, "bad": [1 2]})";
+    fe::ondemand_document broken(partly_broken);
+    CHECK(broken["ok"].get<int64_t>().value() == 1);
+    CHECK(!broken["bad"].parse());
+
+    // Truncated documents give errors, whatever is read
+    std::string truncated_array = R"({"a":[1,2)";
+    fe::ondemand_document truncated(truncated_array);
+    CHECK(!truncated["a"].parse());
+    CHECK(truncated["a"][1].get<int64_t>().value() == 2);
+    std::string no_value = R"({"a":)";
+    fe::ondemand_document missing_value(no_value);
+    CHECK(!missing_value["a"].get<int64_t>());
+    CHECK(!missing_value["a"].parse());
+    CHECK((*missing_value.root().begin()).error());
+    std::string no_colon = R"({"a")";
+    fe::ondemand_document missing_colon(no_colon);
+    CHECK(!missing_colon["a"].get<int64_t>());
+    CHECK((*missing_colon.root().begin()).error());
+    std::string trailing_comma = "[1,";
+    fe::ondemand_document missing_element(trailing_comma);
+    CHECK(missing_element[0].get<int64_t>().value() == 1);
+    CHECK(!missing_element[1].get<int64_t>());
+    CHECK(!missing_element[1].parse());
+    CHECK(missing_element.root().size() == 2u);
+
+    // parse() keeps the document's flags
+    std::string repeated = R"({"list": [{"key": 1}, {"key": 2}]})";
+    fe::ondemand_document interned(repeated, fe::parse_flags::intern_keys);
+    auto list = interned["list"].parse();
+    REQUIRE(list);
+    CHECK(list.value()[0].begin().key().data == list.value()[1].begin().key().data);
+
+    std::string scalar = " 12 ";
+    fe::ondemand_document scalar_doc(scalar);
+    CHECK(scalar_doc.root().get<int64_t>().value() == 12);
+    std::string blank = "  ";
+    fe::ondemand_document empty(blank);
+    CHECK(empty.root().error());
+}
+
+TEST("tape_document") {
+    std::string input = R"({"a": [1, -2.5e3, true, false, null], "b\"c": {"d": "eé\\"}, "e": [], "f": {},
+                            "big": 18446744073709551615, "neg": -9223372036854775808})";
+    auto parsed = fe::tape_document::parse(input);
+    REQUIRE(parsed);
+    const fe::tape_document& doc = parsed.value();
+    auto root = doc.root();
+    REQUIRE(root.is_object());
+    CHECK(root.size() == 6u);
+    CHECK(root["a"].is_array());
+    CHECK(root["a"].size() == 5u);
+    CHECK(root["a"][0].get<int64_t>().value() == 1);
+    CHECK(root["a"][0].get<int32_t>().value() == 1);
+    CHECK(root["a"][1].get<double>().value() == -2500.0);
+    CHECK(root["a"][2].get<bool>().value());
+    CHECK(!root["a"][3].get<bool>().value());
+    CHECK(root["a"][4].is_null());
+    CHECK(!root["a"][5].is_null());
+    CHECK(root["b\"c"]["d"].get<std::string>().value() == u8"eé\\");
+    CHECK(root["e"].size() == 0u);
+    CHECK(!(root["e"].begin() != root["e"].end()));
+    CHECK(root["f"].size() == 0u);
+    CHECK(root["big"].get<uint64_t>().value() == 18446744073709551615ull);
+    CHECK(root["neg"].get<int64_t>().value() == std::numeric_limits<int64_t>::min());
+    CHECK(!root["missing"].get<int64_t>());
+    CHECK(!root["a"].get<int64_t>());
+
+    std::string keys;
+    for (auto it = root.begin(); it != root.end(); ++it) {
+        keys += std::string(it.key().data, it.key().size) + " ";
+    }
+    CHECK(keys == "a b\"c e f big neg ");
+    double sum = 0;
+    for (auto it = root["a"].begin(); it != root["a"].end(); ++it) {
+        if ((*it).is_number()) {
+            sum += (*it).get<double>().value();
+        }
+    }
+    CHECK(sum == -2499.0);
+
+    // The document owns its strings
+    std::string copy = input;
+    auto owned = fe::tape_document::parse(copy);
+    copy.assign(copy.size(), ' ');
+    CHECK(owned.value()["b\"c"]["d"].get<std::string>().value() == u8"eé\\");
+
+    auto scalar = fe::tape_document::parse(std::string(" \"x\" "));
+    REQUIRE(scalar);
+    CHECK(scalar.value().root().get<std::string>().value() == "x");
+    CHECK(!fe::tape_document::parse(std::string("[1, 2")));
+    CHECK(std::string(fe::tape_document::parse(std::string("{\"a\" 1}")).error()) == "Expected ':'");
+}
+
+TEST("json::parse_paths") {
+    std::string input = R"({
+        "user": {"id": 42, "name": "iron", "skipped": {"deep": [1, 2, {"x": "]"}]}},
+        "entities": {"hashtags": [{"text": "a"}, {"text": "b"}], "urls": []},
+        "items": [{"id": 1, "v": "x"}, {"id": 2}, {"id": 3, "v": "z"}],
+        "a/b": {"c~d": true},
+        "never": [1, 2 3]
+    })";
+    auto j = json::parse_paths(input, {"/user/id", "/entities/hashtags", "/items/2/v", "/items/0/id", "/a~1b/c~0d",
+                                       "/user/missing", "/missing", "/items/7"});
+    REQUIRE(j);
+    CHECK(j.value().dump() ==
+          R"({"user":{"id":42},"entities":{"hashtags":[{"text":"a"},{"text":"b"}]},"items":[{"id":1},{"v":"z"}],"a/b":{"c~d":true}})");
+
+    // Array elements are renumbered
+    auto renumbered = json::parse_paths(input, {"/items/2/v"});
+    REQUIRE(renumbered);
+    CHECK(renumbered.value().dump() == R"({"items":[{"v":"z"}]})");
+
+    // A path covering another one takes the whole value
+    auto whole = json::parse_paths(input, {"/user", "/user/id"});
+    REQUIRE(whole);
+    CHECK(whole.value().dump() == R"({"user":{"id":42,"name":"iron","skipped":{"deep":[1,2,{"x":"]"}]}}})");
+
+    auto all = json::parse_paths(R"({"a": [1, 2]})", {""});
+    REQUIRE(all);
+    CHECK(all.value().dump() == R"({"a":[1,2]})");
+
+    auto none = json::parse_paths(input, {"/nope", "/user/nope"});
+    REQUIRE(none);
+    CHECK(none.value().is_null());
+
+    CHECK(!json::parse_paths(input, {"/never"}));
+    CHECK(!json::parse_paths(input, {"no slash"}));
+}
+
+TEST("json::parse_until") {
+    // Nothing after the routing key is looked at
+    std::string routed = R"({"type": "push", "repo": {"id": 7, "tags": ["a", "b"]}, "payload": [1, 2 3)";
+    auto type = json::parse_until(routed, {"/type"});
+    REQUIRE(type);
+    CHECK(type.value().dump() == R"({"type":"push"})");
+
+    auto tag = json::parse_until(routed, {"/repo/tags/1", "/type"});
+    REQUIRE(tag);
+    CHECK(tag.value().dump() == R"({"type":"push","repo":{"id":7,"tags":["a","b"]}})");
+
+    // Duplicate keys only count once
+    auto both = json::parse_until(R"({"a": 1, "a": 2, "b": 3, "c": })", {"/a", "/b"});
+    REQUIRE(both);
+    CHECK(both.value().dump() == R"({"a":1,"a":2,"b":3})");
+
+    // Keys past the first window of the index
+    std::string padded = R"({"pad": [)";
+    for (int i = 0; i < 50000; i++) {
+        padded += "10, ";
+    }
+    padded += R"(0], "long": ")" + std::string(100000, 'x') + R"(", "key": "value", "rest": [})";
+    auto far = json::parse_until(padded, {"/key"});
+    REQUIRE(far);
+    CHECK(far.value()["pad"].size() == 50001u);
+    CHECK(far.value()["long"].size() == 100000u);
+    CHECK(far.value()["key"].dump() == R"("value")");
+
+    // Paths that aren't there need the whole document
+    CHECK(!json::parse_until(routed, {"/missing"}));
+    auto whole = json::parse_until(R"({"a": [1, 2]})", {"/missing"});
+    REQUIRE(whole);
+    CHECK(whole.value().dump() == R"({"a":[1,2]})");
+    CHECK(!json::parse_until(R"({"a": 1} x)", {"/missing"}));
+    CHECK(!json::parse_until(routed, {"type"}));
+}
+
+TEST("parser") {
+    fe::parser parser;
+    auto first = parser.parse(R"({"id": 1, "tags": ["a", "b"], "text": "esc\"aped"})");
+    REQUIRE(first);
+    CHECK(first.value()->dump() == R"({"id":1,"tags":["a","b"],"text":"esc\"aped"})");
+
+    std::string big = "[";
+    for (int i = 0; i < 2000; i++) {
+        big += R"("a long string that fills up the arena", )";
+    }
+    big += "0]";
+    auto second = parser.parse(big);
+    REQUIRE(second);
+    CHECK(second.value()->size() == 2001u);
+
+    CHECK(!parser.parse(R"({"id": 1,)"));
+    CHECK(!parser.parse(R"({"id": 1} 2)"));
+
+    auto third = parser.parse(R"({"id": 3})");
+    REQUIRE(third);
+    CHECK((*third.value())["id"].get<int64_t>().value() == 3);
+    parser.clear();
+}
+
+TEST("parsed containers keep their elements in the arena") {
+    json copy;
+    {
+        auto doc = json::parse(R"({"a": [1, [2, 3], {"b": "c"}], "d": {"e": [true]}})");
+        REQUIRE(doc);
+        json& a = doc.value()["a"];
+        a.push_back(4);
+        a[1].push_back(5);
+        doc.value()["d"]["f"] = 6;
+        CHECK(doc.value().dump() == R"({"a":[1,[2,3,5],{"b":"c"},4],"d":{"e":[true],"f":6}})");
+        // Copies go on the heap and outlive the document
+        copy = a;
+    }
+    CHECK(copy.dump() == R"([1,[2,3,5],{"b":"c"},4])");
+}
+
+TEST("parse_flags::exact_size") {
+    const char* docs[] = {
+        R"({"a": [1, 2.5, -3, true, false, null], "b": {"c": "d", "e": {}, "f": []}, "g": "esc\n\"apedé"})",
+        R"([[[[]]], {"": ""}, "x", 1e10])",
+        R"("just a string")",
+        R"(12)",
+        R"({})",
+    };
+    for (const char* doc : docs) {
+        auto expected = json::parse(doc);
+        REQUIRE(expected);
+        auto exact = json::parse(doc, fe::parse_flags::exact_size);
+        REQUIRE(exact);
+        CHECK(exact.value().dump() == expected.value().dump());
+        CHECK(exact.value().arena()->blocks() == 1u);
+        auto insitu = json::parse(doc, fe::parse_flags::exact_size | fe::parse_flags::insitu);
+        REQUIRE(insitu);
+        CHECK(insitu.value().dump() == expected.value().dump());
+        CHECK(insitu.value().arena()->blocks() == 1u);
+    }
+
+    // Larger documents with every kind of value still fit in the one block that was measured
+    for (const char* path : {"data/demo.json", "data/github_events.json"}) {
+        std::ifstream f(path);
+        std::stringstream ss;
+        ss << f.rdbuf();
+        std::string input = ss.str();
+        REQUIRE(!input.empty());
+        auto exact = json::parse(input, fe::parse_flags::exact_size);
+        REQUIRE(exact);
+        CHECK(exact.value().arena()->blocks() == 1u);
+        auto insitu = json::parse(input, fe::parse_flags::exact_size | fe::parse_flags::insitu);
+        REQUIRE(insitu);
+        CHECK(insitu.value().arena()->blocks() == 1u);
+    }
+    CHECK(!json::parse(R"({"a": [1, 2}, "b": })", fe::parse_flags::exact_size));
+    CHECK(!json::parse(R"(]]]]}}}"a")", fe::parse_flags::exact_size));
+}
+
+TEST("parse_flags::intern_keys") {
+    std::string input = R"([{"id": 1, "name": "a"}, {"name": "b", "id": 2, "esc": 3, "esc": 4}])";
+    // Where the n-th key of an object is stored
+    auto key_at = [](json& object, size_t n) {
+        auto it = object.items().begin();
+        std::advance(it, n);
+        return static_cast<const void*>(it->first.data);
+    };
+    auto same = [](const void* a, const void* b) {
+        return a == b;
+    };
+
+    auto doc = json::parse(input, fe::parse_flags::intern_keys);
+    REQUIRE(doc);
+    json& events = doc.value();
+    CHECK(same(key_at(events[0], 0), key_at(events[1], 1)));
+    CHECK(same(key_at(events[0], 1), key_at(events[1], 0)));
+    CHECK(same(key_at(events[1], 2), key_at(events[1], 3)));
+    CHECK(events.dump() == json::parse(input).value().dump());
+
+    auto plain = json::parse(input);
+    REQUIRE(plain);
+    CHECK(!same(key_at(plain.value()[0], 0), key_at(plain.value()[1], 1)));
+
+    auto insitu = json::parse(input, fe::parse_flags::intern_keys | fe::parse_flags::insitu);
+    REQUIRE(insitu);
+    CHECK(same(key_at(insitu.value()[0], 0), key_at(insitu.value()[1], 1)));
+
+    // Keys in a shared table aren't copied, and the table isn't changed
+    fe::key_table keys{"id", "name"};
+    fe::string_t id = keys.find("id");
+    REQUIRE(id.data);
+    CHECK(!keys.find("esc").data);
+    auto shared = json::parse(input, keys);
+    REQUIRE(shared);
+    CHECK(same(key_at(shared.value()[0], 0), id.data));
+    CHECK(same(key_at(shared.value()[1], 1), id.data));
+    CHECK(same(key_at(shared.value()[1], 2), key_at(shared.value()[1], 3)));
+    CHECK(keys.size() == 2u);
+    CHECK(shared.value()[1][id].get<int64_t>().value() == 2);
+    CHECK(shared.value()[1][keys.add("esc")].get<int64_t>().value() == 3);
+}
+
+TEST("object lookup by key hash") {
+    std::string input = "{";
+    for (int i = 0; i < 100; i++) {
+        input += (i ? ", \"key" : "\"key") + std::to_string(i) + "\": " + std::to_string(i);
+    }
+    input += R"(, "": -1, "key": "escaped"})";
+    auto doc = json::parse(input);
+    REQUIRE(doc);
+    json& o = doc.value();
+    bool all_found = true;
+    for (int i = 0; i < 100; i++) {
+        all_found &= o["key" + std::to_string(i)].get<int64_t>().value() == i;
+    }
+    CHECK(all_found);
+    CHECK(o[""].get<int64_t>().value() == -1);
+    CHECK(o["key"].get<std::string>().value() == "escaped");
+    CHECK(o.size() == 102u);
+
+    // Entries added, grown into and copied all still match
+    for (int i = 100; i < 200; i++) {
+        o["key" + std::to_string(i)] = i;
+    }
+    // A value taken out of one entry and put in another is found under its new key only
+    json seven = std::move(o["key7"]);
+    o["moved"] = std::move(seven);
+    json copy = o;
+    all_found = true;
+    for (int i = 0; i < 200; i++) {
+        all_found &= i == 7 || copy["key" + std::to_string(i)].get<int64_t>().value() == i;
+    }
+    CHECK(all_found);
+    CHECK(copy["moved"].get<int64_t>().value() == 7);
+    CHECK(copy["key7"].is_null());
+    CHECK(copy.size() == 203u);
+
+    // Members reordered, renamed or erased through items() are found where they are now
+    auto small = json::parse(R"({"b": 2, "a": 1, "c": 3, "d": 4})");
+    REQUIRE(small);
+    json& s = small.value();
+    CHECK(s["b"].get<int64_t>().value() == 2);
+    auto items = s.items();
+    std::iter_swap(items.begin(), items.begin() + 1);
+    items.begin()->first = fe::string_t{const_cast<char*>("z"), 1};
+    items.o.erase(items.begin() + 2);
+    CHECK(s["b"].get<int64_t>().value() == 2);
+    CHECK(s["z"].get<int64_t>().value() == 1);
+    CHECK(s["d"].get<int64_t>().value() == 4);
+    CHECK(s["c"].is_null());
+    CHECK(s.size() == 4u);
+}
+
+TEST("large objects are looked up through an index") {
+    // Crosses object_t::index_threshold while keys are added and looked up in turn, so the index
+    // is built, extended with new members and rebuilt as it fills
+    json owned;
+    json doc = json::doc();
+    json& in_arena = doc["dictionary"];
+    bool all_found = true;
+    for (int i = 0; i < 3000; i++) {
+        std::string key = "id_" + std::to_string(i * 31);
+        owned[key] = i;
+        in_arena[key] = i;
+        all_found &= owned["id_" + std::to_string(i / 2 * 31)].get<int64_t>().value() == i / 2;
+        all_found &= in_arena["id_" + std::to_string(i / 2 * 31)].get<int64_t>().value() == i / 2;
+    }
+    CHECK(all_found);
+    CHECK(owned.size() == 3000u);
+    CHECK(in_arena.size() == 3000u);
+    CHECK(owned["id_1"].is_null());
+    CHECK(owned.size() == 3001u);
+
+    // Copies and assigned objects index their own members
+    json copy = in_arena;
+    owned = copy;
+    all_found = true;
+    for (int i = 0; i < 3000; i++) {
+        std::string key = "id_" + std::to_string(i * 31);
+        all_found &= copy[key].get<int64_t>().value() == i && owned[key].get<int64_t>().value() == i;
+    }
+    CHECK(all_found);
+    CHECK(owned.size() == 3000u);
+
+    // With repeated keys the first one is found, as with a scan
+    std::string input = "{";
+    for (int i = 0; i < 100; i++) {
+        input += "\"k" + std::to_string(i % 40) + "\": " + std::to_string(i) + ", ";
+    }
+    input += "\"last\": null}";
+    auto parsed = json::parse(input);
+    REQUIRE(parsed);
+    all_found = true;
+    for (int i = 0; i < 40; i++) {
+        all_found &= parsed.value()["k" + std::to_string(i)].get<int64_t>().value() == i;
+    }
+    CHECK(all_found);
+    CHECK(parsed.value().size() == 101u);
+
+    // Changes made through items() that keep the size, after the index was built
+    json keys = json::doc();
+    for (int i = 1; i <= 40; i++) {
+        keys["k" + std::to_string(i)] = i;
+    }
+    CHECK(keys["k40"].get<int64_t>().value() == 40);
+    auto members = keys.items();
+    std::iter_swap(members.begin() + 1, members.begin() + 2);
+    CHECK(keys["k2"].get<int64_t>().value() == 2);
+    CHECK(keys["k3"].get<int64_t>().value() == 3);
+    auto again = keys.items();
+    again.o.erase(again.begin());
+    std::swap(again.begin()->first, (again.begin() + 5)->first);
+    keys["k41"] = 41;
+    CHECK(keys["k41"].get<int64_t>().value() == 41);
+    CHECK(keys["k3"].get<int64_t>().value() == 7);
+    CHECK(keys["k7"].get<int64_t>().value() == 3);
+    CHECK(keys["k2"].get<int64_t>().value() == 2);
+    CHECK(keys.size() == 40u);
+    all_found = true;
+    for (int i = 4; i <= 41; i++) {
+        all_found &= i == 7 || keys["k" + std::to_string(i)].get<int64_t>().value() == i;
+    }
+    CHECK(all_found);
+    CHECK(keys.size() == 40u);
+
+    // Swapped objects keep finding their own members
+    json left;
+    json right;
+    for (int i = 0; i < 50; i++) {
+        left["l" + std::to_string(i)] = i;
+        right["r" + std::to_string(i)] = i;
+    }
+    fe::object_t& l = left.items().o;
+    fe::object_t& r = right.items().o;
+    CHECK(left["l5"].get<int64_t>().value() == 5);
+    CHECK(right["r5"].get<int64_t>().value() == 5);
+    swap(l, r);
+    CHECK(left["r7"].get<int64_t>().value() == 7);
+    CHECK(right["l7"].get<int64_t>().value() == 7);
+    CHECK(left.size() == 50u);
+    CHECK(right.size() == 50u);
+}